@@ -87,10 +87,6 @@ off64_t BitmapTree::bitRequire() {
     }
   }
 
-  for(int i = 0; i < _deep; i++) {
-    printf("bits offset = %ld \n", bitsOffs[i]);
-  }
-
   /* if found, reset bit upward, calculate total offsets */
   if(found) {
     for(int i = (_deep -1); i >= 0; i--) {
@@ -104,3 +100,174 @@ off64_t BitmapTree::bitRequire() {
 }
 
 
+AtomicBitmapTree::AtomicBitmapTree(size_t size) : _deep(0), _size(size) {
+  stack<Layer> layers;
+  size_t lsize = size;
+
+  /* same shape as BitmapTree, top layer has one word, tree of one bit still needs its leaf word */
+  while (lsize > 1 || (1 == lsize && layers.empty())) {
+    Layer layer;
+    layer._lwords = (lsize + LONG_BITS - 1) >> 6;
+    layer._bits = new atomic<uint64_t>[layer._lwords];
+
+    for(size_t i = 0; i < layer._lwords; i++) {
+      layer._bits[i].store(~0UL, memory_order_relaxed);
+    }
+
+    /* fix last uint64_t */
+    size_t tailBits = (lsize & 0x3F);
+    if(0 != tailBits) {
+      layer._bits[layer._lwords - 1].store(-1UL << (LONG_BITS - tailBits), memory_order_relaxed);
+    }
+
+    layers.push(layer);
+    lsize = layer._lwords;
+  }
+
+  _deep = layers.size();
+  for(uint i = 0; i < ARRAY_SIZE(_layers); i++) {
+    if(!layers.empty()) {
+      _layers[i] = layers.top();
+      layers.pop();
+    } else {
+      _layers[i]._bits = nullptr;
+      _layers[i]._lwords = 0;
+    }
+  }
+}
+
+
+AtomicBitmapTree::~AtomicBitmapTree() {
+  for(uint i = 0; i < _deep; i++) {
+    delete[] _layers[i]._bits;
+  }
+  _deep = 0;
+}
+
+
+off64_t AtomicBitmapTree::claimInWord(size_t lwoff) {
+  atomic<uint64_t>& word = _layers[_deep - 1]._bits[lwoff];
+  uint64_t old = word.load(memory_order_acquire);
+
+  while(0 != old) {
+    size_t bit = __builtin_clzl(old);
+    uint64_t updated = old & ~bitMask(bit);
+    if(word.compare_exchange_weak(old, updated, memory_order_seq_cst, memory_order_acquire)) {
+      if(0 == updated && _deep > 1) {
+        clearUp(_deep - 2, lwoff);
+      }
+      return (lwoff << 6) + bit;
+    }
+  }
+  return -1;
+}
+
+
+off64_t AtomicBitmapTree::descend(size_t hint) const {
+  size_t lwoff = 0;
+
+  for(int i = 0; i < _deep - 1; i++) {
+    uint64_t bits = _layers[i]._bits[lwoff].load(memory_order_acquire);
+    if(0 == bits) {
+      return -1;
+    }
+
+    // prefer bits at or after the hint position in this word, spread threads.
+    size_t from = (hint >> (6 * (_deep - 2 - i))) & 0x3F;
+    uint64_t after = bits & (~0UL >> from);
+    lwoff = (lwoff << 6) + __builtin_clzl(0 != after ? after : bits);
+  }
+  return lwoff;
+}
+
+
+size_t& AtomicBitmapTree::localHint() {
+  static __thread HintSlot slots[HINT_SLOTS];
+
+  /* trees hashed to the same slot just lose the hint, it's never wrong */
+  HintSlot& slot = slots[(reinterpret_cast<uintptr_t>(this) >> 4) & (HINT_SLOTS - 1)];
+  if(slot._tree != this) {
+    slot._tree = this;
+    /* start threads from different words */
+    slot._hint = reinterpret_cast<uintptr_t>(slots) >> 12;
+  }
+  return slot._hint;
+}
+
+
+off64_t AtomicBitmapTree::bitRequire() {
+  if(__builtin_expect((0 == _deep), 0)) {
+    return -1;
+  }
+
+  size_t& hint = localHint();
+  size_t lwords = _layers[_deep - 1]._lwords;
+  off64_t offset;
+
+  if(hint >= lwords) {
+    hint %= lwords;
+  }
+
+  /* try the word we used last time */
+  if((offset = claimInWord(hint)) >= 0) {
+    return offset;
+  }
+
+  /* upper layers point to a word with free bit, top word 0 means full, clearUp never leaves it stale */
+  for(int retry = 0; retry < 2; retry++) {
+    off64_t lwoff = descend(hint);
+    if(lwoff < 0) {
+      return -1;
+    }
+    if((offset = claimInWord(lwoff)) >= 0) {
+      hint = lwoff;
+      return offset;
+    }
+  }
+
+  /* upper bits found are stale, scan leaf words */
+  for(size_t i = 1; i <= lwords; i++) {
+    size_t lwoff = (hint + i) % lwords;
+    if((offset = claimInWord(lwoff)) >= 0) {
+      hint = lwoff;
+      return offset;
+    }
+  }
+  return -1;
+}
+
+
+void AtomicBitmapTree::bitTurnback(off64_t idx) {
+  if(__builtin_expect((idx < 0 || static_cast<size_t>(idx) >= _size), 0)) {
+    return;
+  }
+  setUp(_deep - 1, idx);
+}
+
+
+void AtomicBitmapTree::setUp(int layer, size_t bitIdx) {
+  for(; layer >= 0; layer--) {
+    uint64_t old = _layers[layer]._bits[bitIdx >> 6].fetch_or(bitMask(bitIdx), memory_order_seq_cst);
+    if(0 != old) {
+      break;
+    }
+    /* word got first free bit, upper layer must know */
+    bitIdx >>= 6;
+  }
+}
+
+
+void AtomicBitmapTree::clearUp(int layer, size_t bitIdx) {
+  uint64_t mask = bitMask(bitIdx);
+  uint64_t old = _layers[layer]._bits[bitIdx >> 6].fetch_and(~mask, memory_order_seq_cst);
+
+  if(0 == (old & ~mask) && layer > 0) {
+    clearUp(layer - 1, bitIdx >> 6);
+  }
+
+  /* the word below may get free bits again before we cleared, set it back. seq_cst orders this load
+     after the clear, against setUp which sets the word below before this one */
+  if(0 != _layers[layer + 1]._bits[bitIdx].load(memory_order_seq_cst)) {
+    setUp(layer, bitIdx);
+  }
+}
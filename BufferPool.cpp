@@ -0,0 +1,156 @@
+#include <stdlib.h>
+
+#include "BufferPool.hpp"
+
+using namespace netio;
+
+const size_t BufferPool::MIN_SHIFT;
+const size_t BufferPool::MAX_SHIFT;
+const size_t BufferPool::CLASS_COUNT;
+const size_t BufferPool::CACHE_BYTES;
+
+__thread BufferPool::ThreadCache* BufferPool::_localCache = nullptr;
+__thread bool BufferPool::_exited = false;
+thread_local BufferPool::CacheGuard BufferPool::_guard;
+
+BufferPool::ThreadCache::ThreadCache() :
+    _remote(),
+    _refs(1)
+{
+  for(size_t i = 0; i < CLASS_COUNT; i++) {
+    _free[i] = nullptr;
+    _count[i] = 0;
+  }
+}
+
+BufferPool::CacheGuard::~CacheGuard() {
+  ThreadCache* cache = _localCache;
+  _localCache = nullptr;
+  _exited = true;
+
+  if(nullptr == cache) {
+    return;
+  }
+
+  drainRemote(cache);
+  for(size_t i = 0; i < CLASS_COUNT; i++) {
+    while(nullptr != cache->_free[i]) {
+      FreeBlock* block = cache->_free[i];
+      cache->_free[i] = block->_link;
+      ::free(headerOf(block));
+    }
+    cache->_count[i] = 0;
+  }
+
+  // blocks still in use are returned to the queue, the last one frees the cache.
+  release(cache);
+}
+
+BufferPool::ThreadCache* BufferPool::localCache() {
+  if(LIKELY(nullptr != _localCache)) {
+    return _localCache;
+  }
+
+  // thread is exiting, don't cache any more.
+  if(UNLIKELY(_exited)) {
+    return nullptr;
+  }
+
+  // make sure guard is constructed, so cache is cleaned up on thread exit.
+  (void)&_guard;
+  // keep cache on its own cache lines, away from other thread's data.
+  void* mem = nullptr;
+  if(0 != ::posix_memalign(&mem, CACHE_LINE_SIZE, sizeof(ThreadCache))) {
+    return nullptr;
+  }
+  _localCache = ::new(mem) ThreadCache();
+  return _localCache;
+}
+
+void* BufferPool::allocate(size_t size) {
+  size_t cls = classOf(size);
+  ThreadCache* cache = (cls < CLASS_COUNT) ? localCache() : nullptr;
+  BlockHeader* header = nullptr;
+
+  if(LIKELY(nullptr != cache)) {
+    if(nullptr == cache->_free[cls]) {
+      drainRemote(cache);
+    }
+
+    FreeBlock* block = cache->_free[cls];
+    if(LIKELY(nullptr != block)) {
+      cache->_free[cls] = block->_link;
+      cache->_count[cls]--;
+      header = headerOf(block);
+    }
+    cache->_refs.fetch_add(1, memory_order_relaxed);
+  }
+
+  if(nullptr == header) {
+    size_t bytes = (cls < CLASS_COUNT) ? classSize(cls) : size;
+    header = static_cast<BlockHeader*>(::malloc(sizeof(BlockHeader) + bytes));
+    if(UNLIKELY(nullptr == header)) {
+      if(nullptr != cache) {
+        cache->_refs.fetch_sub(1, memory_order_relaxed);
+      }
+      throw bad_alloc();
+    }
+  }
+
+  header->_owner = cache;
+  header->_cls = cls;
+  return payloadOf(header);
+}
+
+void BufferPool::deallocate(void* ptr) {
+  if(UNLIKELY(nullptr == ptr)) {
+    return;
+  }
+
+  BlockHeader* header = headerOf(ptr);
+  ThreadCache* cache = header->_owner;
+
+  if(nullptr == cache) {
+    ::free(header);
+  } else if(cache == _localCache) {
+    cacheBlock(cache, header);
+    cache->_refs.fetch_sub(1, memory_order_relaxed);
+  } else {
+    // give back to creating thread.
+    cache->_remote.push(::new(ptr) FreeBlock());
+    release(cache);
+  }
+}
+
+void BufferPool::cacheBlock(ThreadCache* cache, BlockHeader* header) {
+  size_t cls = header->_cls;
+  if(cache->_count[cls] * classSize(cls) < CACHE_BYTES) {
+    FreeBlock* block = static_cast<FreeBlock*>(payloadOf(header));
+    block->_link = cache->_free[cls];
+    cache->_free[cls] = block;
+    cache->_count[cls]++;
+  } else {
+    ::free(header);
+  }
+}
+
+void BufferPool::drainRemote(ThreadCache* cache) {
+  FreeBlock* block;
+  while(nullptr != (block = cache->_remote.pop())) {
+    cacheBlock(cache, headerOf(block));
+  }
+}
+
+void BufferPool::release(ThreadCache* cache) {
+  if(1 != cache->_refs.fetch_sub(1, memory_order_acq_rel)) {
+    return;
+  }
+
+  // thread exited and all blocks are back, nobody else can touch the cache now.
+  FreeBlock* block;
+  while(nullptr != (block = cache->_remote.pop())) {
+    ::free(headerOf(block));
+  }
+  cache->~ThreadCache();
+  ::free(cache);
+}
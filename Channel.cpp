@@ -62,6 +62,22 @@ void Channel::enableAll(bool edgeTrigger) {
   apply();
 }
 
+void Channel::enableEvents(uint32_t events) {
+  uint32_t updated = _events | events;
+  if(updated != _events) {
+    _events = updated;
+    apply();
+  }
+}
+
+void Channel::disableEvents(uint32_t events) {
+  uint32_t updated = _events & ~events;
+  if(updated != _events) {
+    _events = updated;
+    apply();
+  }
+}
+
 void Channel::attach() {
   ASSERT(_fd >= 0);
   
@@ -0,0 +1,111 @@
+#include "ConnectionTable.hpp"
+#include "Logger.hpp"
+
+using namespace netio;
+
+ConnectionTable::ConnectionTable(uint8_t shard) :
+    _shard(shard),
+    _freeSlots(),
+    _nextSlot(0),
+    _size(0)
+{
+  for(uint32_t i = 0; i < MAX_CHUNKS; i++) {
+    _chunks[i].store(nullptr, memory_order_relaxed);
+  }
+}
+
+ConnectionTable::~ConnectionTable() {
+  for(uint32_t i = 0; i < MAX_CHUNKS; i++) {
+    delete[] _chunks[i].load(memory_order_relaxed);
+  }
+}
+
+ConnId ConnectionTable::insert(const SpTcpConnection& conn) {
+  uint32_t index;
+
+  if(!_freeSlots.empty()) {
+    index = _freeSlots.back();
+    _freeSlots.pop_back();
+  } else {
+    if(UNLIKELY(_nextSlot >= MAX_CHUNKS * CHUNK_SIZE)) {
+      LOGE(LOG_NETIO_TAG, "ConnectionTable shard %d is full", _shard);
+      return INVALID_CONN_ID;
+    }
+
+    index = _nextSlot;
+    if(0 == (index & CHUNK_MASK)) {
+      _chunks[index >> CHUNK_BITS].store(new Slot[CHUNK_SIZE], memory_order_release);
+    }
+    _nextSlot++;
+  }
+
+  Slot* slot = getSlot(index);
+  ConnId id = makeId(_shard, slot->_gen, index);
+
+  // id must be visible before the connection can be looked up.
+  conn->setConnId(id);
+  slot->lock();
+  slot->_conn = conn;
+  slot->unlock();
+  _size.fetch_add(1, memory_order_relaxed);
+  return id;
+}
+
+bool ConnectionTable::remove(ConnId id) {
+  uint32_t index = static_cast<uint32_t>(id);
+  if(UNLIKELY(shardOf(id) != _shard || index >= _nextSlot)) {
+    return false;
+  }
+
+  Slot* slot = getSlot(index);
+  if(makeId(_shard, slot->_gen, index) != id) {
+    return false;
+  }
+
+  // drop the reference out of the lock, connection may be destroyed here.
+  SpTcpConnection removed;
+  slot->lock();
+  removed.swap(slot->_conn);
+  slot->unlock();
+
+  // generation 0 is never used, so id is never INVALID_CONN_ID.
+  slot->_gen = (slot->_gen + 1) & GEN_MASK;
+  if(0 == slot->_gen) {
+    slot->_gen = 1;
+  }
+
+  _freeSlots.push_back(index);
+  _size.fetch_sub(1, memory_order_relaxed);
+  return true;
+}
+
+SpTcpConnection ConnectionTable::lookup(ConnId id) const {
+  // id may be stale or forged, check before touching the chunks.
+  uint32_t index = static_cast<uint32_t>(id);
+  if(UNLIKELY(shardOf(id) != _shard || index >= MAX_CHUNKS * CHUNK_SIZE)) {
+    return nullptr;
+  }
+
+  Slot* slot = getSlot(index);
+  if(nullptr == slot) {
+    return nullptr;
+  }
+
+  // slot may be reused by others, check the id the connection holds.
+  slot->lock();
+  SpTcpConnection conn = slot->_conn;
+  slot->unlock();
+  if(nullptr != conn && conn->getConnId() == id) {
+    return conn;
+  }
+  return nullptr;
+}
+
+void ConnectionTable::clear() {
+  for(uint32_t i = 0; i < _nextSlot; i++) {
+    Slot* slot = getSlot(i);
+    if(nullptr != slot->_conn) {
+      remove(slot->_conn->getConnId());
+    }
+  }
+}
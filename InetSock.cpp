@@ -60,6 +60,15 @@ void InetSock::enableReusePort(bool enable) {
   ::setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &optval, static_cast<socklen_t>(sizeof optval));
 }
 
+int InetSock::enableZeroCopy(bool enable) {
+#ifdef SO_ZEROCOPY
+  int optval = enable ? 1 : 0;
+  return ::setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &optval, static_cast<socklen_t>(sizeof optval));
+#else
+  errno = ENOPROTOOPT;
+  return -1;
+#endif
+}
 
 void InetSock::setNonblocking(bool enable) {
   int flags;
@@ -132,6 +141,17 @@ StreamSocket::StreamSocket(uint16_t port) : InetSock(socket(AF_INET, SOCK_STREAM
   }
 }
 
+StreamSocket::StreamSocket(uint16_t port, bool reusePort) : InetSock(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) {
+  ENSURE_FD(_fd);
+  if(reusePort) {
+    enableReuseAddr(true);
+    enableReusePort(true);
+  }
+
+  int ret = bind(port);
+  ENSURE_RET(ret);
+}
+
 StreamSocket::StreamSocket(const struct sockaddr_in& sockaddr) : InetSock(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)){
   ENSURE_FD(_fd);
   int ret = bind(sockaddr);
@@ -157,6 +177,11 @@ int ServerSocket::accept(const struct sockaddr_in& clientaddr) {
   return ::accept(_fd, (struct sockaddr*)&clientaddr, &addrlen);
 }
 
+int ServerSocket::accept4(struct sockaddr_in& clientaddr, int flags) {
+  socklen_t addrlen = static_cast<socklen_t>(sizeof(struct sockaddr_in));
+  return ::accept4(_fd, (struct sockaddr*)&clientaddr, &addrlen, flags);
+}
+
 DGramSocket::DGramSocket(uint16_t port) : InetSock(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) {
   ENSURE_FD(_fd);
   int ret = bind(port);
@@ -5,6 +5,7 @@
 
 #include "Utils.hpp"
 #include "MultiplexLooper.hpp"
+#include "TimeUtil.hpp"
 #include "Logger.hpp"
 
 
@@ -13,8 +14,24 @@ using namespace std;
 namespace netio {
 
 MultiplexLooper::MultiplexLooper() :
-    _pollFd(epoll_create1(EPOLL_CLOEXEC))
+    MultiplexLooper(LoopPolicy())
+{}
+
+MultiplexLooper::MultiplexLooper(const LoopPolicy& policy) :
+    _pollFd(epoll_create1(EPOLL_CLOEXEC)),
+    _statWakeups(0),
+    _statEvents(0),
+    _statBusyPollHits(0),
+    _statIdleUs(0),
+    _statBatchSize(0),
+    _wakeStampUs(0),
+    _connections(0),
+    _pendingRunnables(0),
+    _load(0),
+    _loadStampUs(TimeUtil::monotonicUs())
 {
+  setLoopPolicy(policy);
+
   _wakeupChan = new EventChannel(this);
   _runnableChan = new EventChannel(this);
 
@@ -26,7 +43,56 @@ MultiplexLooper::MultiplexLooper() :
   _looping = true;
 }
 
+void MultiplexLooper::setLoopPolicy(const LoopPolicy& policy) {
+  _policy = policy;
+
+  if(0 == _policy._initEvents) {
+    _policy._initEvents = 1;
+  }
+  if(_policy._maxEvents < _policy._initEvents) {
+    _policy._maxEvents = _policy._initEvents;
+  }
+}
+
+LoopStats MultiplexLooper::getLoopStats() const {
+  LoopStats stats;
+  stats._wakeups = _statWakeups.load(memory_order_relaxed);
+  stats._events = _statEvents.load(memory_order_relaxed);
+  stats._busyPollHits = _statBusyPollHits.load(memory_order_relaxed);
+  stats._idleUs = _statIdleUs.load(memory_order_relaxed);
+  stats._batchSize = _statBatchSize.load(memory_order_relaxed);
+  return stats;
+}
+
+uint64_t MultiplexLooper::loadCounter() const {
+  uint64_t load = _load.load(memory_order_relaxed);
+  uint64_t stamp = _loadStampUs.load(memory_order_relaxed);
+  uint64_t now = TimeUtil::monotonicUs();
+
+  // looper may block for long without updating, decay it by reader.
+  uint64_t halves = (now > stamp) ? (now - stamp) / LOAD_HALF_LIFE_US : 0;
+  return (halves >= 64) ? 0 : (load >> halves);
+}
+
+void MultiplexLooper::updateLoad(int evCount) {
+  uint64_t load = _load.load(memory_order_relaxed);
+  uint64_t stamp = _loadStampUs.load(memory_order_relaxed);
+  uint64_t halves = (_wakeStampUs - stamp) / LOAD_HALF_LIFE_US;
+
+  if(halves > 0) {
+    load = (halves >= 64) ? 0 : (load >> halves);
+    _loadStampUs.store(stamp + halves * LOAD_HALF_LIFE_US, memory_order_relaxed);
+  }
+  _load.store(load + evCount, memory_order_relaxed);
+}
+
 MultiplexLooper::~MultiplexLooper() {
+  RunnableNode* node;
+  while(nullptr != (node = _runnables.pop())) {
+    delete node;
+  }
+
+  delete _runnableChan;
   delete _wakeupChan;
   if(_pollFd >= 0) {
     close(_pollFd);
@@ -35,17 +101,27 @@ MultiplexLooper::~MultiplexLooper() {
 
 void MultiplexLooper::startLoop() {
   _threadId = this_thread::get_id();
-  vector<struct epoll_event> events(20);
+  vector<struct epoll_event> events(_policy._initEvents);
+  size_t lowRounds = 0;
+
+  _statBatchSize.store(events.size(), memory_order_relaxed);
 
   LOGD(LOG_NETIO_TAG, "MultiplexLooper start loop, thread id=0x%X", _threadId);
   
   while(_looping) {
-    int evCount = epoll_wait(_pollFd, &*events.begin(), events.size(), -1);
+    int evCount = pollEvents(events);
     
     if(UNLIKELY(evCount < 0)) {
-      LOGE("Looper", "epoll_wait");
+      if(EINTR != errno) {
+        LOGE("Looper", "epoll_wait");
+      }
+      continue;
     }
 
+    statAdd(_statWakeups, 1);
+    statAdd(_statEvents, evCount);
+    updateLoad(evCount);
+
     for(int i = 0; i < evCount; i++) {
       Channel* channel = static_cast<Channel*>(events[i].data.ptr);
       if(UNLIKELY(events[i].events & EPOLLHUP)) {
@@ -64,9 +140,28 @@ void MultiplexLooper::startLoop() {
         channel->handleWrite();
       }
     }
-    
-    if(UNLIKELY(static_cast<size_t>(evCount) == events.size())) {
-      events.resize(events.size() * 2);
+
+    if(!_afterTasks.empty()) {
+      runAfterTasks();
+    }
+
+    // adapt event array to the batch size we really got.
+    size_t batch = events.size();
+    if(UNLIKELY(static_cast<size_t>(evCount) == batch)) {
+      lowRounds = 0;
+      if(batch < _policy._maxEvents) {
+        events.resize(std::min(batch * 2, _policy._maxEvents));
+        _statBatchSize.store(events.size(), memory_order_relaxed);
+      }
+    } else if((static_cast<size_t>(evCount) << 2) <= batch && batch > _policy._initEvents) {
+      if(++lowRounds >= BATCH_SHRINK_ROUNDS) {
+        lowRounds = 0;
+        events.resize(std::max(batch / 2, _policy._initEvents));
+        events.shrink_to_fit();
+        _statBatchSize.store(events.size(), memory_order_relaxed);
+      }
+    } else {
+      lowRounds = 0;
     }
   }
 
@@ -74,6 +169,62 @@ void MultiplexLooper::startLoop() {
   
 }
 
+int MultiplexLooper::pollEvents(vector<struct epoll_event>& events) {
+  int evCount = 0;
+  uint64_t start = TimeUtil::monotonicUs();
+
+  if(_policy._busyPollUs > 0) {
+    do {
+      evCount = epoll_wait(_pollFd, &*events.begin(), events.size(), 0);
+      if(0 != evCount) {
+        if(evCount > 0) {
+          statAdd(_statBusyPollHits, 1);
+        }
+        break;
+      }
+    } while(_looping && (TimeUtil::monotonicUs() - start) < _policy._busyPollUs);
+  }
+
+  if(0 == evCount && _looping) {
+    // don't sleep if there are tasks waiting for the end of iteration.
+    int timeout = _afterTasks.empty() ? -1 : 0;
+    evCount = epoll_wait(_pollFd, &*events.begin(), events.size(), timeout);
+  }
+
+  _wakeStampUs = TimeUtil::monotonicUs();
+  statAdd(_statIdleUs, _wakeStampUs - start);
+  return evCount;
+}
+
+void MultiplexLooper::runAfterTasks() {
+  // tasks may add new tasks, they go to next iteration.
+  _runningTasks.swap(_afterTasks);
+  for(size_t i = 0; i < _runningTasks.size(); i++) {
+    _runningTasks[i]();
+  }
+  _runningTasks.clear();
+}
+
+void MultiplexLooper::executeRunnables() {
+  RunnableNode* node;
+  size_t executed = 0;
+
+  while(nullptr != (node = _runnables.pop())) {
+    node->_runnable();
+    delete node;
+
+    if(UNLIKELY(++executed >= RUNNABLE_BATCH)) {
+      // leave the rest to next round, give io events a chance.
+      if(!_runnables.empty()) {
+        _runnableChan->wakeup();
+      }
+      break;
+    }
+  }
+
+  _pendingRunnables.fetch_sub(executed, memory_order_relaxed);
+}
+
 void MultiplexLooper::stopLoop() {
   _looping = false;
   wakeup();
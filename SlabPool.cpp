@@ -0,0 +1,32 @@
+#include "SlabPool.hpp"
+
+using namespace netio;
+
+const size_t SlabPool::SLAB_SIZE;
+const size_t SlabPool::CACHE_MAX;
+
+thread_local SlabPool::ThreadCache SlabPool::_cache;
+
+SlabPool::ThreadCache::~ThreadCache() {
+  for(size_t i = 0; i < _slabs.size(); i++) {
+    delete _slabs[i];
+  }
+  _slabs.clear();
+}
+
+VecData* SlabPool::take() {
+  if(LIKELY(!_cache._slabs.empty())) {
+    VecData* slab = _cache._slabs.back();
+    _cache._slabs.pop_back();
+    return slab;
+  }
+  return new VecData(SLAB_SIZE);
+}
+
+void SlabPool::giveBack(VecData* slab) {
+  if(LIKELY(_cache._slabs.size() < CACHE_MAX)) {
+    _cache._slabs.push_back(slab);
+  } else {
+    delete slab;
+  }
+}
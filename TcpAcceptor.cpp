@@ -1,4 +1,6 @@
 
+#include <fcntl.h>
+
 #include "Utils.hpp"
 #include "TcpAcceptor.hpp"
 #include "TcpConnection.hpp"
@@ -8,11 +10,16 @@
 
 using namespace netio;
 
-TcpAcceptor::TcpAcceptor(MultiplexLooper* looper, uint16_t port) :
-    _sock(port),
-    _channel(looper, _sock.getFd())
+TcpAcceptor::TcpAcceptor(MultiplexLooper* looper, uint16_t port, bool reusePort) :
+    _sock(port, reusePort),
+    _channel(looper, _sock.getFd()),
+    _acceptBatch(64),
+    _idleFd(::open("/dev/null", O_RDONLY | O_CLOEXEC))
 {
   ASSERT(_sock.getFd());
+  CHKRET(_idleFd);
+  // we drain the backlog on each readable event, must not block on the last accept.
+  _sock.setNonblocking(true);
   CHKRET(_sock.listen());
 
   LOGI(LOG_NETIO_TAG, "TcpAcceptor listen-on [%s]", _sock.getLocalAddr().strIpPort().c_str());
@@ -23,24 +30,61 @@ TcpAcceptor::TcpAcceptor(MultiplexLooper* looper, uint16_t port) :
 
 TcpAcceptor::~TcpAcceptor() {
   ASSERT(!_channel.isAttached());
+  // with SO_REUSEPORT, kernel keeps hashing connections to a listening socket until it's closed.
+  _sock.close();
+  if(_idleFd >= 0) {
+    ::close(_idleFd);
+  }
 }
 
 void TcpAcceptor::handleRead() {
-  struct sockaddr_in clientaddr;
-  bzero(&clientaddr, sizeof(struct sockaddr_in));
-  int fd = _sock.accept(clientaddr);
-
-  if(LIKELY(fd >= 0)) {
-    if(LIKELY(_onNewConn)) {
-      _onNewConn(fd, clientaddr);
+  for(size_t i = 0; i < _acceptBatch; i++) {
+    struct sockaddr_in clientaddr;
+    bzero(&clientaddr, sizeof(struct sockaddr_in));
+    int fd = _sock.accept4(clientaddr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if(LIKELY(fd >= 0)) {
+      if(LIKELY(_onNewConn)) {
+        _onNewConn(fd, clientaddr);
+      } else {
+        ::close(fd);
+      }
+    } else if(EAGAIN == errno || EWOULDBLOCK == errno) {
+      // backlog drained
+      break;
+    } else if(EINTR == errno || ECONNABORTED == errno) {
+      continue;
+    } else if(EMFILE == errno || ENFILE == errno) {
+      if(!dropPendingConnection()) {
+        break;
+      }
     } else {
-      ::close(fd);
+      LOGSYSERR();
+      break;
     }
-  } else {
-    LOGSYSERR();
   }
 }
 
+bool TcpAcceptor::dropPendingConnection() {
+  if(_idleFd < 0) {
+    // reserved fd was lost, try to get it back for next time.
+    _idleFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return false;
+  }
+
+  ::close(_idleFd);
+
+  struct sockaddr_in clientaddr;
+  int fd = _sock.accept4(clientaddr, SOCK_CLOEXEC);
+  if(fd >= 0) {
+    LOGW(LOG_NETIO_TAG, "TcpAcceptor run out of fd, drop pending connection");
+    ::close(fd);
+  }
+
+  _idleFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  return (fd >= 0) && (_idleFd >= 0);
+}
+
 void TcpAcceptor::attach() {
   _channel.attach();
 }
@@ -1,35 +1,66 @@
 
 #include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <linux/errqueue.h>
 #include <functional>
 
 #include "InetSock.hpp"
 #include "TcpConnection.hpp"
 #include "VecBuffer.hpp"
+#include "SlabPool.hpp"
 
 
 using namespace netio;
 
 __thread int8_t TcpConnection::_rcvPendingBuffer[SIZE_K(32)];
-const size_t TcpConnection::_predMsgLen = SIZE_K(1);
+const size_t TcpConnection::SND_QUEUE_INIT;
+const size_t TcpConnection::SND_HIGH_MARK;
+const size_t TcpConnection::SND_LOW_MARK;
+const uint32_t TcpConnection::RCV_BUF_MIN;
+const uint32_t TcpConnection::RCV_BUF_MAX;
+const uint32_t TcpConnection::RCV_BUF_INIT;
+const size_t TcpConnection::READ_BUDGET;
 
 
 void TcpConnection::handleRead() {
+  // closed by error handler of the same event.
+  if(UNLIKELY(_sock.getFd() < 0)) {
+    return;
+  }
+
+  if(_newChainHandler) {
+    handleReadChain();
+    return;
+  }
+
+  size_t budget = _readBudget;
+
   while(true) {
     struct iovec iovecs[2];
     ssize_t readed;
     size_t readCap;
+    size_t bufCap;
 
-    // if _rcvBuf has not readable data and more than half size of _rcvBuf was used,
-    // reset it, we will create new buffer for receive.
-    if(0 == _rcvBuf->readableSize() && ((_rcvBuf->writtableSize() << 1) < _predMsgLen)) {
-      _rcvBuf.reset(new VecBuffer(_predMsgLen));
+    // buffer is dropped when drained, create one by predicted size. if there is partial message
+    // and little room left, move it to a new buffer, messages splited out may still share the old one.
+    // new buffer at least doubles, large message is not copied again on every read.
+    size_t predict = predictReceiveSize();
+    if(nullptr == _rcvBuf) {
+      _rcvBuf.reset(new VecBuffer(predict));
+    } else if((_rcvBuf->writtableSize() << 1) < predict) {
+      size_t remain = _rcvBuf->readableSize();
+      SpVecBuffer buffer(new VecBuffer(std::max(remain << 1, remain + predict)));
+      memcpy(buffer->writtablePtr(), _rcvBuf->readablePtr(), remain);
+      buffer->markWrite(remain);
+      _rcvBuf = buffer;
     }
 
-    readCap = _rcvBuf->writtableSize() + sizeof(_rcvPendingBuffer);
-
+    bufCap = _rcvBuf->writtableSize();
+    readCap = bufCap + sizeof(_rcvPendingBuffer);
 
     iovecs[0].iov_base = _rcvBuf->writtablePtr();
-    iovecs[0].iov_len = _rcvBuf->writtableSize();
+    iovecs[0].iov_len = bufCap;
     iovecs[1].iov_base = _rcvPendingBuffer;
     iovecs[1].iov_len = sizeof(_rcvPendingBuffer);
 
@@ -37,17 +68,20 @@ void TcpConnection::handleRead() {
 
     // we have read some buffer
     if(readed > 0) {
-      ssize_t pending = (readed - _rcvBuf->writtableSize());
+      ssize_t pending = (readed - bufCap);
 
       if(UNLIKELY(pending > 0)) {
-        // we read some data to pending buffer, merge them first.
-        _rcvBuf->markWrite(_rcvBuf->writtableSize());
+        // we read some data to pending buffer, merge them first. storage is copied if it's shared.
+        _rcvBuf->markWrite(bufCap);
         _rcvBuf->enlarge(pending);
         memcpy(_rcvBuf->writtablePtr(), _rcvPendingBuffer, pending);
+        _rcvBuf->markWrite(pending);
       } else {
         _rcvBuf->markWrite(readed);
       }
 
+      updateReceiveAverage(readed, bufCap);
+
       // _rcvBuf currentlly store all buffer we have read this time
       if(LIKELY(_newMessageHandler)) {
         _newMessageHandler(this->shared_from_this(), _rcvBuf);
@@ -55,92 +89,465 @@ void TcpConnection::handleRead() {
         COGW("tcpconnection callback, but no message handler");
       }
 
-        
+      // all consumed, don't hold memory for idle connection.
+      if(nullptr != _rcvBuf && 0 == _rcvBuf->readableSize()) {
+        _rcvBuf.reset();
+      }
+
       if(LIKELY(static_cast<size_t>(readed) < readCap)) {
         // we have read all data out
         break;
       }
-    } else if(readed < 0) {
-      // nothing readed
-      if(EAGAIN != errno && EINTR != errno) {
-        detach();
-        _sock.close();
-        if(LIKELY(nullptr != _closedHandler)) {
-          LOGI("tc", "%s close on error, msg=%s", strInfo(), strerror(errno));
-          _closedHandler(this->shared_from_this(), errno);
-        } else {
-          LOGI("tc", "%s close on error, msg=%s, dummy", strInfo(), strerror(errno));
-        }
 
-        errno = 0;
+      // reading paused by handler, e.g. send queue reached high watermark.
+      if(UNLIKELY(!_channel.isReading())) {
+        break;
       }
+
+      if(UNLIKELY(!consumeReadBudget(budget, readed))) {
+        break;
+      }
+    } else {
+      handleReadFailure(readed);
       break;
-    } else { // we got eof
-      detach();
-      _sock.close();
-      if(LIKELY(nullptr != _closedHandler)) {
-        LOGI("tc", "%s close by peer", strInfo());
-        _closedHandler(this->shared_from_this(), 0);
+    }
+  }
+}
+
+void TcpConnection::handleReadChain() {
+  constexpr int slabMax = 4;
+  size_t budget = _readBudget;
+
+  while(true) {
+    struct iovec iovecs[slabMax + 1];
+    VecData* slabs[slabMax];
+    int vecCount = 0;
+    size_t room = 0;
+
+    // fill room left in current slab first.
+    if(nullptr != _rcvSlab && _rcvSlabUsed < _rcvSlab->size()) {
+      room = _rcvSlab->size() - _rcvSlabUsed;
+      iovecs[vecCount].iov_base = &*_rcvSlab->begin() + _rcvSlabUsed;
+      iovecs[vecCount].iov_len = room;
+      vecCount++;
+    }
+
+    for(int i = 0; i < slabMax; i++) {
+      slabs[i] = SlabPool::take();
+      iovecs[vecCount].iov_base = &*slabs[i]->begin();
+      iovecs[vecCount].iov_len = slabs[i]->size();
+      vecCount++;
+    }
+
+    size_t readCap = room + slabMax * SlabPool::SLAB_SIZE;
+    ssize_t readed = _sock.readv(iovecs, vecCount);
+    size_t left = (readed > 0) ? readed : 0;
+
+    // slice what we read out of slabs, no copy.
+    if(room > 0 && left > 0) {
+      size_t n = std::min(left, room);
+      _rcvChain.append(SpVecBuffer(new VecBuffer(_rcvSlab, _rcvSlabUsed, n)));
+      _rcvSlabUsed += n;
+      left -= n;
+    }
+
+    for(int i = 0; i < slabMax; i++) {
+      if(left > 0) {
+        size_t n = std::min(left, SlabPool::SLAB_SIZE);
+        _rcvSlab = SlabPool::wrap(slabs[i]);
+        _rcvSlabUsed = n;
+        _rcvChain.append(SpVecBuffer(new VecBuffer(_rcvSlab, 0, n)));
+        left -= n;
       } else {
-        LOGI("tc", "%s close by peer, dummy", strInfo());        
+        SlabPool::giveBack(slabs[i]);
+      }
+    }
+
+    if(readed > 0) {
+      if(LIKELY(_newChainHandler)) {
+        _newChainHandler(this->shared_from_this(), _rcvChain);
+      }
+
+      if(LIKELY(static_cast<size_t>(readed) < readCap) || UNLIKELY(!_channel.isReading())) {
+        break;
+      }
+
+      if(UNLIKELY(!consumeReadBudget(budget, readed))) {
+        break;
       }
+    } else {
+      handleReadFailure(readed);
       break;
     }
   }
+
+  // nothing pending, don't hold slab for idle connection.
+  if(_rcvChain.empty()) {
+    _rcvSlab.reset();
+    _rcvSlabUsed = 0;
+  }
+}
+
+bool TcpConnection::consumeReadBudget(size_t& budget, size_t readed) {
+  if(0 == budget) {
+    return true;
+  }
+
+  if(readed < budget) {
+    budget -= readed;
+    return true;
+  }
+
+  // used up, there may be more data. edge triggered read won't notify again, come back after
+  // other channels of this iteration are served.
+  if(!_readScheduled) {
+    _readScheduled = true;
+    SpTcpConnection self = this->shared_from_this();
+    _channel.getLooper()->runAfterIteration([self] () {
+        self->_readScheduled = false;
+        if(self->_channel.isReading()) {
+          self->handleRead();
+        }
+      });
+  }
+  return false;
+}
+
+void TcpConnection::handleReadFailure(ssize_t readed) {
+  if(readed < 0) {
+    // nothing readed
+    if(EAGAIN != errno && EINTR != errno) {
+      closeOnError(errno);
+      errno = 0;
+    }
+  } else { // we got eof
+    detach();
+    _sock.close();
+    if(LIKELY(nullptr != _closedHandler)) {
+      LOGI("tc", "%s close by peer", strInfo());
+      _closedHandler(this->shared_from_this(), 0);
+    } else {
+      LOGI("tc", "%s close by peer, dummy", strInfo());        
+    }
+  }
+}
+
+void TcpConnection::closeOnError(int err) {
+  detach();
+  _sock.close();
+  _sndQueue.clear();
+  _sndHeadOffset = 0;
+  _sndBytes = 0;
+  _sndAboveHigh = false;
+  _zcPending.clear();
+
+  if(LIKELY(nullptr != _closedHandler)) {
+    LOGI("tc", "%s close on error, msg=%s", strInfo(), strerror(err));
+    _closedHandler(this->shared_from_this(), err);
+  } else {
+    LOGI("tc", "%s close on error, msg=%s, dummy", strInfo(), strerror(err));
+  }
 }
 
 void TcpConnection::sendInternal() {
-  constexpr int vecMax = 50;
+  constexpr int vecMax = IOV_MAX;
 
+  // connection closed already.
+  if(UNLIKELY(_sock.getFd() < 0)) {
+    _sndQueue.clear();
+    _sndHeadOffset = 0;
+    _sndBytes = 0;
+    _sndAboveHigh = false;
+    return;
+  }
 
   // break on these cases:
   // 1. nothing to be send
-  // 2. send EAGAIN
+  // 2. send EAGAIN or partially sended
   // 3. error occur
-  while(true) {
-    struct iovec iovecs[vecMax] = {0};
-    int vecCount = 0;
-    {
-      unique_lock<mutex> lock(_sndMutex);
+  while(!_sndQueue.empty()) {
+    const SendItem& head = _sndQueue.front();
+    if(head.isFile()) {
+      if(!sendFileInternal()) {
+        return;
+      }
+      continue;
+    }
 
-      if(!_sndBufList.empty()) {
-        vecCount = std::min(_sndBufList.size(), ARRAY_SIZE(iovecs));
+    if(zeroCopyEligible(head.size() - _sndHeadOffset)) {
+      if(!sendZeroCopyInternal()) {
+        return;
+      }
+      continue;
+    }
 
-        auto itSpBuf = _sndBufList.begin();
-        for(int i = 0; i < vecCount; i++) {
-          iovecs[i].iov_base = (*itSpBuf)->readablePtr();
-          iovecs[i].iov_len = (*itSpBuf)->readableSize();
-          itSpBuf++;
-        }
-      } else {
+    // gather buffers until a file region or a buffer to be sended by zero copy.
+    struct iovec iovecs[vecMax];
+    size_t queued = std::min(_sndQueue.size(), static_cast<size_t>(vecMax));
+    int vecCount = 0;
+    size_t total = 0;
+
+    for(size_t i = 0; i < queued && !_sndQueue[i].isFile(); i++) {
+      if(i > 0 && zeroCopyEligible(_sndQueue[i].size())) {
         break;
       }
+      SpVecBuffer& buffer = _sndQueue[i]._buffer;
+      iovecs[vecCount].iov_base = buffer->readablePtr();
+      iovecs[vecCount].iov_len = buffer->readableSize();
+      total += iovecs[vecCount].iov_len;
+      vecCount++;
     }
-      
-    // vecCount will be positive
-    if(vecCount > 0) {
-      size_t sended = _sock.writev(iovecs, vecCount);
-      LOGD("tc", "%s send buffer size=%d", strInfo(), sended);
+    iovecs[0].iov_base = static_cast<CharType*>(iovecs[0].iov_base) + _sndHeadOffset;
+    iovecs[0].iov_len -= _sndHeadOffset;
+    total -= _sndHeadOffset;
 
-      if(LIKELY(sended > 0)) {
-        unique_lock<mutex> lock(_sndMutex);
-        markSended(sended);
-      } else {
-        if(EAGAIN == errno || EINTR == errno) {
-          _channel.enableWrite(true, true);
-        } else {
-          // error occur
-          LOGE("tc", "%s real send error msg=%s", strInfo(), errno);
-          _sock.close();
-          handleClose();
+    ssize_t sended = _sock.writev(iovecs, vecCount);
+    LOGD("tc", "%s send buffer size=%d", strInfo(), sended);
+
+    if(!handleSended(sended, total)) {
+      return;
+    }
+  }
+
+  // all sended, stop watching writtable.
+  _channel.disableEvents(Channel::EVENT_WRITE);
+}
+
+bool TcpConnection::handleSended(ssize_t sended, size_t expected) {
+  if(LIKELY(sended > 0)) {
+    markSended(static_cast<size_t>(sended));
+    if(static_cast<size_t>(sended) < expected) {
+      // socket buffer is full, wait for writtable.
+      _channel.enableEvents(Channel::EVENT_WRITE);
+      return false;
+    }
+    return true;
+  }
+
+  if(EINTR == errno) {
+    return true;
+  } else if(EAGAIN == errno) {
+    _channel.enableEvents(Channel::EVENT_WRITE);
+  } else {
+    LOGE("tc", "%s real send error msg=%s", strInfo(), strerror(errno));
+    closeOnError(errno);
+  }
+  return false;
+}
+
+bool TcpConnection::sendFileInternal() {
+  const SpFileRegion& file = _sndQueue.front()._file;
+  off_t offset = file->offset() + _sndHeadOffset;
+  size_t count = file->length() - _sndHeadOffset;
+
+  ssize_t sended = _sock.sendfile(file->fd(), &offset, count);
+  LOGD("tc", "%s sendfile size=%d", strInfo(), sended);
+
+  if(UNLIKELY(0 == sended)) {
+    // file is shorter than the region, peer would wait for bytes never come.
+    LOGE("tc", "%s sendfile reach end of file, fd=%d", strInfo(), file->fd());
+    closeOnError(EIO);
+    return false;
+  }
+
+  return handleSended(sended, count);
+}
+
+bool TcpConnection::sendZeroCopyInternal() {
+  // hold buffer, it may be popped by markSended.
+  SpVecBuffer buffer = _sndQueue.front()._buffer;
+  struct iovec iov;
+  struct msghdr msg;
+
+  iov.iov_base = buffer->readablePtr() + _sndHeadOffset;
+  iov.iov_len = buffer->readableSize() - _sndHeadOffset;
+  bzero(&msg, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  ssize_t sended = _sock.sendmsg(msg, MSG_ZEROCOPY);
+  if(LIKELY(sended > 0)) {
+    // every successful zero copy call takes a sequence number.
+    ZeroCopyPending pending = {_zcNextSeq++, false, buffer};
+    _zcPending.push_back(pending);
+  } else if(ENOBUFS == errno) {
+    // exceed optmem limit, copy this time.
+    sended = _sock.write(iov.iov_base, iov.iov_len);
+  }
+
+  LOGD("tc", "%s send zero copy size=%zd", strInfo(), sended);
+  return handleSended(sended, iov.iov_len);
+}
+
+void TcpConnection::setZeroCopyThreshold(size_t threshold) {
+  if(threshold > 0 && 0 == _zcThreshold) {
+    if(0 != _sock.enableZeroCopy(true)) {
+      LOGW("tc", "%s zero copy not supported, msg=%s", strInfo(), strerror(errno));
+      return;
+    }
+  }
+  _zcThreshold = threshold;
+}
+
+void TcpConnection::readZeroCopyCompletions() {
+  while(!_zcPending.empty()) {
+    char control[128];
+    struct msghdr msg;
+    bzero(&msg, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if(_sock.recvmsg(msg, MSG_ERRQUEUE) < 0) {
+      break;
+    }
+
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); nullptr != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if(!((SOL_IP == cmsg->cmsg_level && IP_RECVERR == cmsg->cmsg_type)
+           || (SOL_IPV6 == cmsg->cmsg_level && IPV6_RECVERR == cmsg->cmsg_type))) {
+        continue;
+      }
+
+      const struct sock_extended_err* serr = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cmsg));
+      if(SO_EE_ORIGIN_ZEROCOPY != serr->ee_origin || 0 != serr->ee_errno) {
+        continue;
+      }
+
+      // completed range [ee_info, ee_data], sequence wraps around, ranges may come out of order.
+      uint32_t head = _zcPending.front()._seq;
+      int64_t lo = static_cast<int32_t>(serr->ee_info - head);
+      int64_t hi = static_cast<int32_t>(serr->ee_data - head);
+      lo = std::max(lo, static_cast<int64_t>(0));
+      hi = std::min(hi, static_cast<int64_t>(_zcPending.size()) - 1);
+      for(int64_t i = lo; i <= hi; i++) {
+        _zcPending[i]._done = true;
+        _zcPending[i]._buffer.reset();
+      }
+
+      while(!_zcPending.empty() && _zcPending.front()._done) {
+        _zcPending.pop_front();
+      }
+
+      if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        // kernel copied anyway (e.g. loopback), zero copy only costs more.
+        if(_zcThreshold > 0) {
+          LOGI("tc", "%s zero copy deferred to copy by kernel, disabled", strInfo());
+          _zcThreshold = 0;
         }
-        break;
       }
-    } else {
-      break;
     }
   }
 }
 
+void TcpConnection::handleError() {
+  if(UNLIKELY(_sock.getFd() < 0)) {
+    return;
+  }
+
+  if(!_zcPending.empty()) {
+    readZeroCopyCompletions();
+  }
+
+  int err = _sock.getSocketError();
+  if(0 != err) {
+    closeOnError(err);
+  }
+}
+
+void TcpConnection::sendInLoop(const SpVecBuffer& data) {
+  if(UNLIKELY(nullptr == data || 0 == data->readableSize())) {
+    return;
+  }
+
+  // waiting for writtable or flush, keep order.
+  if(!_sndQueue.empty()) {
+    enqueueSend(data);
+    return;
+  }
+
+  if(_deferFlush) {
+    enqueueSend(data);
+    flushOrDefer();
+    return;
+  }
+
+  if(UNLIKELY(_sock.getFd() < 0)) {
+    return;
+  }
+
+  size_t len = data->readableSize();
+  if(zeroCopyEligible(len)) {
+    enqueueSend(data);
+    sendInternal();
+    return;
+  }
+
+  ssize_t sended = _sock.write(data->readablePtr(), len);
+
+  if(LIKELY(static_cast<size_t>(sended) == len)) {
+    return;
+  }
+
+  if(sended < 0) {
+    if(EAGAIN != errno && EINTR != errno) {
+      LOGE("tc", "%s real send error msg=%s", strInfo(), strerror(errno));
+      closeOnError(errno);
+      return;
+    }
+    sended = 0;
+  }
+
+  // queue the tail, wait for writtable.
+  enqueueSend(data, static_cast<size_t>(sended));
+  _channel.enableEvents(Channel::EVENT_WRITE);
+}
+
+void TcpConnection::flushOrDefer() {
+  if(!_deferFlush) {
+    sendInternal();
+    return;
+  }
+
+  if(!_flushScheduled) {
+    _flushScheduled = true;
+    SpTcpConnection self = this->shared_from_this();
+    _channel.getLooper()->runAfterIteration([self] () {
+        self->_flushScheduled = false;
+        // if waiting for writtable, writable event will flush it.
+        if(!self->_channel.isWriting()) {
+          self->sendInternal();
+        }
+      });
+  }
+}
+
+void TcpConnection::handleHighWatermark() {
+  _sndAboveHigh = true;
+  LOGD("tc", "%s reach high watermark, pending=%zu", strInfo(), _sndBytes);
 
+  if(_pauseReadOnHigh) {
+    _channel.disableEvents(Channel::EVENT_READ);
+    _readPausedByHigh = true;
+  }
 
+  if(_highWatermarkHandler) {
+    _highWatermarkHandler(this->shared_from_this(), _sndBytes);
+  }
+}
+
+void TcpConnection::handleWriteDrained() {
+  _sndAboveHigh = false;
+  LOGD("tc", "%s drop to low watermark, pending=%zu", strInfo(), _sndBytes);
+
+  // resume what high watermark paused, even if pausing is switched off meanwhile.
+  // epoll reports data already arrived when read is enabled again.
+  if(_readPausedByHigh) {
+    _readPausedByHigh = false;
+    if(_sock.getFd() >= 0) {
+      _channel.enableEvents(Channel::EVENT_READ);
+    }
+  }
+
+  if(_writeDrainedHandler) {
+    _writeDrainedHandler(this->shared_from_this());
+  }
+}
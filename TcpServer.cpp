@@ -1,4 +1,6 @@
 
+#include <future>
+
 #include "TcpServer.hpp"
 #include "Logger.hpp"
 #include "Utils.hpp"
@@ -8,37 +10,103 @@ using namespace netio;
 
 const char* TcpServer::LOG_TAG = "TcpServ";
 
-TcpServer::TcpServer(uint16_t port, SpLooperPool loopPool) :
+TcpServer::TcpServer(uint16_t port, SpLooperPool loopPool, bool reusePort) :
     _loopPool(loopPool),
     _mainLooper(loopPool->getLooper()),
-    _acceptor(_mainLooper, port),
+    _reusePort(reusePort),
+    _acceptors(),
+    _connTables(),
     _newConnHandler(std::bind(&TcpServer::dummyConnectionHandler, this, placeholders::_1))
 {
+  // shard of connection id has 8 bits
+  ASSERT(_loopPool->size() <= 256);
+  for(size_t i = 0; i < _loopPool->size(); i++) {
+    _connTables.push_back(new ConnectionTable(static_cast<uint8_t>(i)));
+  }
+
+  if(_reusePort) {
+    for(size_t i = 0; i < _loopPool->size(); i++) {
+      _acceptors.push_back(SpTcpAcceptor(new TcpAcceptor(_loopPool->getLooperAt(i), port, true)));
+    }
+  } else {
+    _acceptors.push_back(SpTcpAcceptor(new TcpAcceptor(_mainLooper, port)));
+  }
 }
 
 TcpServer::~TcpServer() {
-  auto iter = _connSet.begin();
-  while(iter != _connSet.end()) {
-    (*iter)->detach();
-    iter++;
+  stopWork();
+
+  // accept events already polled may still hand connections over, let every looper finish them.
+  runOnLoopers([] (size_t) {});
+
+  // table is owned by its looper, tear it down there after pending add/remove tasks.
+  runOnLoopers([this] (size_t shard) {
+      _connTables[shard]->forEach([] (SpTcpConnection& conn) { conn->detach(); });
+      _connTables[shard]->clear();
+    });
+
+  for(size_t i = 0; i < _connTables.size(); i++) {
+    delete _connTables[i];
+  }
+  _connTables.clear();
+}
+
+void TcpServer::runOnLoopers(const function<void(size_t)>& task) {
+  vector<promise<void> > done(_loopPool->size());
+
+  for(size_t i = 0; i < _loopPool->size(); i++) {
+    MultiplexLooper* looper = _loopPool->getLooperAt(i);
+    promise<void>* finished = &done[i];
+    ASSERT(!looper->inLooperThread());
+
+    looper->postRunnable([looper, &task, i, finished] () {
+        looper->runAfterIteration([looper, &task, i, finished] () {
+            task(i);
+            // tasks queued after this one in the iteration may still use the server.
+            looper->runAfterIteration([finished] () { finished->set_value(); });
+          });
+      });
+  }
+
+  for(size_t i = 0; i < done.size(); i++) {
+    done[i].get_future().wait();
   }
-  _connSet.clear();
-  _acceptor.detach();
 }
 
 
 void TcpServer::startWork() {
-  _acceptor.setNewConnCallback(bind(&TcpServer::onNewConnection, this, placeholders::_1, placeholders::_2));
-  _acceptor.attach();
+  for(size_t i = 0; i < _acceptors.size(); i++) {
+    MultiplexLooper* looper = _reusePort ? _acceptors[i]->getLooper() : nullptr;
+    _acceptors[i]->setNewConnCallback(bind(&TcpServer::onNewConnection, this, looper, placeholders::_1, placeholders::_2));
+    _acceptors[i]->attach();
+  }
 }
 
 void TcpServer::stopWork() {
-  _acceptor.detach();
+  for(size_t i = 0; i < _acceptors.size(); i++) {
+    _acceptors[i]->detach();
+  }
 }
 
-void TcpServer::onNewConnection(int fd, const InetAddr& addr) {
-  SpTcpConnection spConn = SpTcpConnection(new TcpConnection(_loopPool->getLooper(), fd, addr.getSockAddr()));
-  _connSet.insert(spConn);
-  _newConnHandler(spConn);
+void TcpServer::onNewConnection(MultiplexLooper* looper, int fd, const InetAddr& addr) {
+  if(nullptr == looper) {
+    // prefer looper on the same NUMA node as the accepting cpu, connection state stays node local.
+    looper = _loopPool->getLooperOnNode(LooperPool<MultiplexLooper>::currentNode());
+  }
+
+  // acceptor gives us non blocking fd.
+  SpTcpConnection spConn = SpTcpConnection(new TcpConnection(looper, fd, addr.getSockAddr(), true));
+  size_t shard = _loopPool->indexOf(looper);
+
+  // table is owned by the looper, runs inline if we accept on the connection's looper.
+  looper->postRunnable(bind(&TcpServer::addConnInLoop, this, shard, spConn));
+}
+
+void TcpServer::addConnInLoop(size_t shard, SpTcpConnection& conn) {
+  if(UNLIKELY(INVALID_CONN_ID == _connTables[shard]->insert(conn))) {
+    LOGE(LOG_TAG, "%s register connection failed", conn->strInfo());
+    return;
+  }
+  _newConnHandler(conn);
 }
 
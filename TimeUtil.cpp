@@ -49,5 +49,12 @@ uint64_t TimeUtil::timestampMS() {
   return _tv.tv_sec * 1000 + _tv.tv_usec / 1000;
 }
 
+uint64_t TimeUtil::monotonicUs() {
+  struct timespec _ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &_ts);
+  return static_cast<uint64_t>(_ts.tv_sec) * 1000000 + _ts.tv_nsec / 1000;
+}
+
 }
 
@@ -4,6 +4,7 @@
 #include <stack>
 #include <string.h>
 #include <mutex>
+#include <atomic>
 
 #include "Utils.hpp"
 
@@ -46,14 +47,14 @@ class BitmapLayer {
    * @return : if original uint64_t is 0, return true, else return false
    */
   bool set(uint bitIdx) {
-    if(__builtin_expect((bitIdx > _size), 0)) {
+    if(__builtin_expect((bitIdx >= _size), 0)) {
       return false;
     }
     
     off64_t lwoff = bitIdx >> 6;
     /* if original is 0, set one bit will affect up layer */
     bool upApply = !(_bits[lwoff]);
-    _bits[lwoff] |= (1 << (LONG_BITS - 1 - (bitIdx & 0x3F)));
+    _bits[lwoff] |= (1UL << (LONG_BITS - 1 - (bitIdx & 0x3F)));
     return upApply;
   }
 
@@ -65,7 +66,7 @@ class BitmapLayer {
    * @return : reset layer's bit offset and return it's uint64_t index
    */
   bool reset(uint bitIdx) {
-    if(__builtin_expect((bitIdx > _size), 0)) {
+    if(__builtin_expect((bitIdx >= _size), 0)) {
       return false;
     }
 
@@ -146,9 +147,69 @@ class BitmapTree {
   uint8_t _deep;
 };
 
+/**
+ * Lock free variant of BitmapTree, same layout : bit 1 means free, and a bit of upper layer is 1
+ * if the word below it has any free bit.
+ *
+ * Bits are claimed by CAS on 64 bits atomic words. Search starts from a hint word kept by each thread for
+ * each tree, so threads spread over different words. A bit of upper layer may be stale for a moment while other threads are
+ * updating the word below, so clearing an upper bit always re-checks the word below and sets it back if
+ * the word got free bits again. Upper layers are only hints, when descending hits a stale bit, search
+ * falls back to scan leaf words.
+ */
+class AtomicBitmapTree {
+  struct Layer {
+    atomic<uint64_t>* _bits;
+    size_t _lwords;
+  };
+
+  // thread local hint of a tree, trees share a few slots.
+  struct HintSlot {
+    const AtomicBitmapTree* _tree;
+    size_t _hint;
+  };
+  static const size_t HINT_SLOTS = 16;
+ public:
+  AtomicBitmapTree(size_t size);
+  ~AtomicBitmapTree();
 
+  AtomicBitmapTree(const AtomicBitmapTree&) = delete;
+  AtomicBitmapTree& operator= (const AtomicBitmapTree&) = delete;
 
+  uint8_t getDeep() const {
+    return _deep;
+  }
 
+  /** 
+   * require one bit from bitmap tree, thread safe.
+   * 
+   * @return : offset of leafs, -1 if all bits are used.
+   */
+  off64_t bitRequire();
 
+  /** 
+   * Return bit to bitmap tree, thread safe.
+   * 
+   * @param idx 
+   */
+  void bitTurnback(off64_t idx);
 
+ private:
+  static uint64_t bitMask(size_t bitIdx) {
+    return 1UL << (LONG_BITS - 1 - (bitIdx & 0x3F));
+  }
 
+  // claim a free bit in leaf word, -1 if the word is full.
+  off64_t claimInWord(size_t lwoff);
+  // hint word of this tree for current thread.
+  size_t& localHint();
+  // find leaf word has free bit by descending from top, -1 if not found.
+  off64_t descend(size_t hint) const;
+  // bit of layer is set to 1/0, propagate to upper layers.
+  void setUp(int layer, size_t bitIdx);
+  void clearUp(int layer, size_t bitIdx);
+
+  Layer _layers[BMT_MAX_DEEP];
+  uint8_t _deep;
+  size_t _size;
+};
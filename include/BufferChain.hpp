@@ -0,0 +1,254 @@
+#pragma once
+
+#include <deque>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "Utils.hpp"
+#include "VecBuffer.hpp"
+
+using namespace std;
+
+namespace netio {
+
+/**
+ * Segmented buffer, a chain of VecBuffer slices act as one readable buffer.
+ *
+ * Slices are referenced but not copied, message inside one slice is split out with zero copy,
+ * only message straddles slices is gathered into a new buffer. Responses can be composed from cached
+ * fragments by appending/prepending their slices, and sent by writev.
+ *
+ * Slice objects may be shared by copied chains and send queue, they are copied on write : slice is
+ * marked in place only if the chain is its only holder, otherwise it's replaced by a new view.
+ *
+ * NOTE : buffer chain is not design for threading safe.
+ */
+class BufferChain {
+ public:
+  BufferChain() : _slices(), _size(0) {}
+
+  size_t readableSize() const {
+    return _size;
+  }
+
+  bool empty() const {
+    return 0 == _size;
+  }
+
+  size_t sliceCount() const {
+    return _slices.size();
+  }
+
+  /**
+   * Append readable data of slice to the tail, chain keeps its own view, so later marks on slice
+   * don't affect the chain. If it continues the last slice in the same vector data, they merge.
+   */
+  void append(const SpVecBuffer& slice) {
+    if(!merge(slice)) {
+      _slices.push_back(slice->share());
+    }
+  }
+
+  /**
+   * Append slice and take it over if nobody else holds it, saves a view.
+   */
+  void append(SpVecBuffer&& slice) {
+    if(!merge(slice)) {
+      _slices.push_back(slice.unique() ? std::move(slice) : slice->share());
+    }
+  }
+
+  /**
+   * Put slice in front of the chain, e.g. header encoded after the body.
+   */
+  void prepend(const SpVecBuffer& slice) {
+    size_t len = slice->readableSize();
+    if(0 == len) {
+      return;
+    }
+
+    _slices.push_front(slice->share());
+    _size += len;
+  }
+
+  /**
+   * Append all slices of other chain, no copy. Slice objects are shared, both chains copy on write.
+   */
+  void append(const BufferChain& other) {
+    if(UNLIKELY(&other == this)) {
+      BufferChain copy(other);
+      append(copy);
+      return;
+    }
+
+    for(auto iter = other._slices.begin(); iter != other._slices.end(); iter++) {
+      if(!merge(*iter)) {
+        _slices.push_back(*iter);
+      }
+    }
+  }
+
+  /**
+   * Visit slices from head to tail.
+   */
+  template <typename Visitor>
+  void forEachSlice(Visitor visitor) const {
+    for(auto iter = _slices.begin(); iter != _slices.end(); iter++) {
+      visitor(*iter);
+    }
+  }
+
+  /**
+   * Get pointer to first len bytes as contiguous memory. Only if they straddle slices,
+   * they are gathered into one new slice.
+   *
+   * @return : nullptr if not enough readable bytes.
+   */
+  const CharType* peekContiguous(size_t len) {
+    if(len > _size || 0 == len) {
+      return nullptr;
+    }
+
+    if(len <= _slices.front()->readableSize()) {
+      return _slices.front()->readablePtr();
+    }
+
+    SpVecBuffer gathered(new VecBuffer(len));
+    peek(gathered->writtablePtr(), len);
+    gathered->markWrite(len);
+    markRead(len);
+    prepend(gathered);
+    return gathered->readablePtr();
+  }
+
+  /**
+   * copy first len bytes to dst without consuming them.
+   *
+   * @return : false if not enough readable bytes.
+   */
+  bool peek(void* dst, size_t len) const {
+    if(len > _size) {
+      return false;
+    }
+
+    CharType* dstptr = static_cast<CharType*>(dst);
+    for(auto iter = _slices.begin(); len > 0; iter++) {
+      size_t n = std::min(len, (*iter)->readableSize());
+      ::memcpy(dstptr, (*iter)->readablePtr(), n);
+      dstptr += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  /**
+   * Consume len bytes from head.
+   */
+  void markRead(size_t len) {
+    ASSERT(len <= _size);
+    _size -= len;
+
+    while(len > 0) {
+      size_t n = _slices.front()->readableSize();
+      if(len < n) {
+        owned(_slices.front())->markRead(len);
+        break;
+      }
+      len -= n;
+      _slices.pop_front();
+    }
+  }
+
+  /**
+   * Take first len bytes out as one buffer. Zero copy if they are in the first slice,
+   * otherwise they are gathered into new buffer.
+   *
+   * @return : nullptr if not enough readable bytes.
+   */
+  SpVecBuffer split(size_t len) {
+    if(len > _size || 0 == len) {
+      return nullptr;
+    }
+
+    SpVecBuffer& first = _slices.front();
+    if(len <= first->readableSize()) {
+      SpVecBuffer splited = owned(first)->split(len);
+      _size -= len;
+      if(0 == first->readableSize()) {
+        _slices.pop_front();
+      }
+      return splited;
+    }
+
+    SpVecBuffer gathered(new VecBuffer(len));
+    peek(gathered->writtablePtr(), len);
+    gathered->markWrite(len);
+    markRead(len);
+    return gathered;
+  }
+
+  /**
+   * Fill iovecs with readable slices, for writev.
+   *
+   * @return : count of iovec filled.
+   */
+  int exportIovecs(struct iovec* iovecs, int count) const {
+    return exportIovecs(iovecs, count, 0);
+  }
+
+  /**
+   * Fill iovecs with readable slices, skip first offset bytes (already sended).
+   */
+  int exportIovecs(struct iovec* iovecs, int count, size_t offset) const {
+    int filled = 0;
+    for(auto iter = _slices.begin(); iter != _slices.end() && filled < count; iter++) {
+      size_t len = (*iter)->readableSize();
+      if(offset >= len) {
+        offset -= len;
+        continue;
+      }
+      iovecs[filled].iov_base = (*iter)->readablePtr() + offset;
+      iovecs[filled].iov_len = len - offset;
+      offset = 0;
+      filled++;
+    }
+    return filled;
+  }
+
+  void clear() {
+    _slices.clear();
+    _size = 0;
+  }
+
+ private:
+  // slice to be marked in place, replaced by a new view if others hold it too.
+  static SpVecBuffer& owned(SpVecBuffer& slice) {
+    if(!slice.unique()) {
+      slice = slice->share();
+    }
+    return slice;
+  }
+
+  // count slice in, extend the last slice if slice continues it. return false if slice should be pushed.
+  bool merge(const SpVecBuffer& slice) {
+    size_t len = slice->readableSize();
+    if(0 == len) {
+      return true;
+    }
+
+    _size += len;
+    if(!_slices.empty()) {
+      SpVecBuffer& last = _slices.back();
+      if(last->bufferPtr() == slice->bufferPtr() && last->writtablePtr() == slice->readablePtr()) {
+        owned(last)->markWrite(len);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  deque<SpVecBuffer> _slices;
+  size_t _size;
+};
+
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "MpscQueue.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+namespace netio {
+
+/**
+ * Thread caching buffer pool with power of two size classes, from 64 bytes to 64K.
+ *
+ * Each thread keeps free blocks of every class, allocate and free in the same thread touch no lock.
+ * Block freed by other thread is pushed back to the lock free queue of its creating thread, and reused
+ * there. Size larger than the max class goes to malloc directly.
+ *
+ * Cache of a thread lives until the thread exits and all blocks it created are freed.
+ */
+class BufferPool {
+ public:
+  static const size_t MIN_SHIFT = 6;
+  static const size_t MAX_SHIFT = 16;
+  static const size_t CLASS_COUNT = MAX_SHIFT - MIN_SHIFT + 1;
+  // bytes of free blocks kept by each class of each thread.
+  static const size_t CACHE_BYTES = SIZE_K(256);
+
+  static void* allocate(size_t size);
+  static void deallocate(void* ptr);
+
+  /**
+   * Size class of size, CLASS_COUNT if it's larger than the max class.
+   */
+  static size_t classOf(size_t size) {
+    size_t cls = 0;
+    while(cls < CLASS_COUNT && (static_cast<size_t>(1) << (cls + MIN_SHIFT)) < size) {
+      cls++;
+    }
+    return cls;
+  }
+
+  static size_t classSize(size_t cls) {
+    return static_cast<size_t>(1) << (cls + MIN_SHIFT);
+  }
+
+ private:
+  struct ThreadCache;
+
+  // put before payload, keep payload 16 bytes aligned.
+  struct BlockHeader {
+    ThreadCache* _owner;    // nullptr for block not cached
+    size_t _cls;
+  };
+  static_assert(sizeof(BlockHeader) == 16, "payload of buffer pool block must keep 16 bytes aligned");
+
+  // freed block, payload is reused as link.
+  struct FreeBlock : public MpscNode {
+    FreeBlock* _link;
+  };
+
+  struct ThreadCache {
+    ThreadCache();
+
+    FreeBlock* _free[CLASS_COUNT];
+    size_t _count[CLASS_COUNT];
+    // blocks freed by other threads.
+    MpscQueue<FreeBlock> _remote;
+    // blocks out of the cache, plus one while the thread is alive.
+    atomic<size_t> _refs;
+  };
+
+  // destroy cache of current thread on exit.
+  struct CacheGuard {
+    ~CacheGuard();
+  };
+
+  static BlockHeader* headerOf(void* ptr) {
+    return static_cast<BlockHeader*>(ptr) - 1;
+  }
+
+  static void* payloadOf(BlockHeader* header) {
+    return header + 1;
+  }
+
+  static ThreadCache* localCache();
+  static void cacheBlock(ThreadCache* cache, BlockHeader* header);
+  static void drainRemote(ThreadCache* cache);
+  static void release(ThreadCache* cache);
+
+  static __thread ThreadCache* _localCache;
+  static __thread bool _exited;
+  static thread_local CacheGuard _guard;
+};
+
+/**
+ * Allocator draws memory from BufferPool. Elements are default initialized, so buffer of char
+ * is not zero filled.
+ */
+template <class T>
+class PoolAllocator {
+ public:
+  typedef T value_type;
+
+  template <class U>
+  struct rebind {
+    typedef PoolAllocator<U> other;
+  };
+
+  PoolAllocator() noexcept {}
+
+  template <class U>
+  PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(BufferPool::allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t) {
+    BufferPool::deallocate(ptr);
+  }
+
+  template <class U>
+  void construct(U* ptr) {
+    ::new(static_cast<void*>(ptr)) U;
+  }
+
+  template <class U, class... Args>
+  void construct(U* ptr, Args&&... args) {
+    ::new(static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+  }
+};
+
+template <class T, class U>
+bool operator== (const PoolAllocator<T>&, const PoolAllocator<U>&) {
+  return true;
+}
+
+template <class T, class U>
+bool operator!= (const PoolAllocator<T>&, const PoolAllocator<U>&) {
+  return false;
+}
+
+}
@@ -74,6 +74,13 @@ class Channel {
   void enableWrite(bool edgeTrigger, bool oneShot);
   void enableAll(bool edgeTrigger);
 
+  // turn on/off some event bits and keep the others, looper is updated only if events changed.
+  void enableEvents(uint32_t events);
+  void disableEvents(uint32_t events);
+
+  bool isReading() const { return 0 != (_events & EVENT_READ); }
+  bool isWriting() const { return 0 != (_events & EVENT_WRITE); }
+
   uint32_t getEvents() const {
     return _events;
   }
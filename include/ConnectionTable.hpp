@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "TcpConnection.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+namespace netio {
+
+/**
+ * Connection table of one looper (a shard of the server's connection registry).
+ *
+ * Connection is indexed by a compact ConnId : [shard 8 bits][generation 24 bits][slot 32 bits].
+ * Slot is reused after removal, generation changes so stale id won't find the new connection.
+ *
+ * insert/remove/forEach must be called by the owner looper thread, they are O(1).
+ * lookup can be called from any thread.
+ *
+ * Connection pointer of a slot is guarded by a spin lock of the slot itself, held only for copying the
+ * shared_ptr, so lookups never contend with other slots or shards (atomic_load of shared_ptr would
+ * share a process wide mutex pool). Owner thread reads it without lock, it's the only writer.
+ *
+ * Slots are stored in chunks which never move once allocated, so readers don't race with growth.
+ */
+class ConnectionTable {
+  struct Slot {
+    Slot() : _gen(1), _locked(false), _conn() {}
+
+    void lock() {
+      while(_locked.exchange(true, memory_order_acquire)) {
+        while(_locked.load(memory_order_relaxed)) {
+#if defined(__x86_64__) || defined(__i386__)
+          __builtin_ia32_pause();
+#endif
+        }
+      }
+    }
+
+    void unlock() {
+      _locked.store(false, memory_order_release);
+    }
+
+    uint32_t _gen;    // owner thread only
+    atomic<bool> _locked;
+    SpTcpConnection _conn;  // written under lock by owner thread
+  };
+ public:
+  explicit ConnectionTable(uint8_t shard);
+  ~ConnectionTable();
+
+  ConnectionTable(const ConnectionTable&) = delete;
+  ConnectionTable& operator= (const ConnectionTable&) = delete;
+
+  static uint8_t shardOf(ConnId id) {
+    return static_cast<uint8_t>(id >> 56);
+  }
+
+  /**
+   * Add connection to the table, set id to the connection and return it.
+   * return INVALID_CONN_ID if the table is full.
+   */
+  ConnId insert(const SpTcpConnection& conn);
+
+  /**
+   * remove connection by id, return false if id is stale.
+   */
+  bool remove(ConnId id);
+
+  /**
+   * find connection by id from any thread, nullptr if not found.
+   */
+  SpTcpConnection lookup(ConnId id) const;
+
+  size_t size() const {
+    return _size.load(memory_order_relaxed);
+  }
+
+  /**
+   * Visit all connection, owner thread only.
+   */
+  template <typename Visitor>
+  void forEach(Visitor visitor) {
+    for(uint32_t i = 0; i < _nextSlot; i++) {
+      Slot& slot = _chunks[i >> CHUNK_BITS].load(memory_order_relaxed)[i & CHUNK_MASK];
+      if(nullptr != slot._conn) {
+        visitor(slot._conn);
+      }
+    }
+  }
+
+  /**
+   * Remove all connections, owner thread only.
+   */
+  void clear();
+
+ private:
+  static const uint32_t CHUNK_BITS = 12;
+  static const uint32_t CHUNK_SIZE = (1 << CHUNK_BITS);
+  static const uint32_t CHUNK_MASK = (CHUNK_SIZE - 1);
+  // 4M connections each shard
+  static const uint32_t MAX_CHUNKS = 1024;
+  static const uint32_t GEN_MASK = 0xFFFFFF;
+
+  static ConnId makeId(uint8_t shard, uint32_t gen, uint32_t slot) {
+    return (static_cast<ConnId>(shard) << 56) | (static_cast<ConnId>(gen & GEN_MASK) << 32) | slot;
+  }
+
+  // nullptr if index is out of the table or its chunk is not allocated.
+  Slot* getSlot(uint32_t index) const {
+    if(UNLIKELY(index >= MAX_CHUNKS * CHUNK_SIZE)) {
+      return nullptr;
+    }
+    Slot* chunk = _chunks[index >> CHUNK_BITS].load(memory_order_acquire);
+    return (nullptr != chunk) ? &chunk[index & CHUNK_MASK] : nullptr;
+  }
+
+  uint8_t _shard;
+  atomic<Slot*> _chunks[MAX_CHUNKS];
+  // slots released, reused first.
+  vector<uint32_t> _freeSlots;
+  // slots never used start from here.
+  uint32_t _nextSlot;
+  atomic<size_t> _size;
+};
+
+}
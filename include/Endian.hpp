@@ -1,10 +1,63 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 #include <endian.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 namespace netio {
 
+/**
+ * Reverse byte order of N bytes integer type, selected at compile time, compiles to one bswap.
+ */
+template <size_t N>
+struct ByteSwap;
+
+template <>
+struct ByteSwap<1> {
+  template <typename T>
+  static T swap(T x) { return x; }
+};
+
+template <>
+struct ByteSwap<2> {
+  template <typename T>
+  static T swap(T x) {
+    uint16_t u;
+    ::memcpy(&u, &x, sizeof(u));
+    u = __builtin_bswap16(u);
+    ::memcpy(&x, &u, sizeof(u));
+    return x;
+  }
+};
+
+template <>
+struct ByteSwap<4> {
+  template <typename T>
+  static T swap(T x) {
+    uint32_t u;
+    ::memcpy(&u, &x, sizeof(u));
+    u = __builtin_bswap32(u);
+    ::memcpy(&x, &u, sizeof(u));
+    return x;
+  }
+};
+
+template <>
+struct ByteSwap<8> {
+  template <typename T>
+  static T swap(T x) {
+    uint64_t u;
+    ::memcpy(&u, &x, sizeof(u));
+    u = __builtin_bswap64(u);
+    ::memcpy(&x, &u, sizeof(u));
+    return x;
+  }
+};
+
 
 class Endian {
  public:
@@ -31,6 +84,108 @@ class Endian {
   static uint64_t ntoh64(uint64_t x) {
     return be64toh(x);
   }
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+  static const bool HOST_LITTLE = true;
+#else
+  static const bool HOST_LITTLE = false;
+#endif
+
+  /**
+   * Convert between host order and big/little endian for any 1/2/4/8 bytes type.
+   */
+  template <typename T>
+  static T toBig(T x) {
+    return HOST_LITTLE ? ByteSwap<sizeof(T)>::swap(x) : x;
+  }
+
+  template <typename T>
+  static T fromBig(T x) {
+    return toBig(x);
+  }
+
+  template <typename T>
+  static T toLittle(T x) {
+    return HOST_LITTLE ? x : ByteSwap<sizeof(T)>::swap(x);
+  }
+
+  template <typename T>
+  static T fromLittle(T x) {
+    return toLittle(x);
+  }
+
+  /**
+   * Reverse byte order of each element of array in place, SSSE3 shuffles 16 bytes at a time if available.
+   */
+  static void swapArray16(uint16_t* data, size_t count) {
+    size_t i = 0;
+#ifdef __SSSE3__
+    const __m128i mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    for(; i + 8 <= count; i += 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_shuffle_epi8(v, mask));
+    }
+#endif
+    for(; i < count; i++) {
+      uint16_t x;
+      ::memcpy(&x, data + i, sizeof(x));
+      x = __builtin_bswap16(x);
+      ::memcpy(data + i, &x, sizeof(x));
+    }
+  }
+
+  static void swapArray32(uint32_t* data, size_t count) {
+    size_t i = 0;
+#ifdef __SSSE3__
+    const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    for(; i + 4 <= count; i += 4) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_shuffle_epi8(v, mask));
+    }
+#endif
+    for(; i < count; i++) {
+      uint32_t x;
+      ::memcpy(&x, data + i, sizeof(x));
+      x = __builtin_bswap32(x);
+      ::memcpy(data + i, &x, sizeof(x));
+    }
+  }
+
+  static void swapArray64(uint64_t* data, size_t count) {
+    size_t i = 0;
+#ifdef __SSSE3__
+    const __m128i mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    for(; i + 2 <= count; i += 2) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_shuffle_epi8(v, mask));
+    }
+#endif
+    for(; i < count; i++) {
+      uint64_t x;
+      ::memcpy(&x, data + i, sizeof(x));
+      x = __builtin_bswap64(x);
+      ::memcpy(data + i, &x, sizeof(x));
+    }
+  }
+
+  /**
+   * Swap array of any 1/2/4/8 bytes type, data may be unaligned.
+   */
+  static void swapArray(void* data, size_t elemSize, size_t count) {
+    switch(elemSize) {
+      case 2:
+        swapArray16(static_cast<uint16_t*>(data), count);
+        break;
+      case 4:
+        swapArray32(static_cast<uint32_t*>(data), count);
+        break;
+      case 8:
+        swapArray64(static_cast<uint64_t*>(data), count);
+        break;
+      default:
+        break;
+    }
+  }
 };
 
 }
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "Noncopyable.hpp"
+#include "Utils.hpp"
+
+using namespace std;
+
+namespace netio {
+
+/**
+ * Region of a file to be sent with sendfile, content is never read into user space.
+ *
+ * If autoClose is set, fd is closed when region is released, after it's sended or connection closed.
+ */
+class FileRegion : public Noncopyable {
+ public:
+  FileRegion(int fd, off_t offset, size_t len, bool autoClose = false) :
+      _fd(fd),
+      _offset(offset),
+      _len(len),
+      _autoClose(autoClose)
+  {
+    ASSERT(fd >= 0);
+  }
+
+  ~FileRegion() {
+    if(_autoClose) {
+      ::close(_fd);
+    }
+  }
+
+  int fd() const { return _fd; }
+  off_t offset() const { return _offset; }
+  size_t length() const { return _len; }
+
+ private:
+  int _fd;
+  off_t _offset;
+  size_t _len;
+  bool _autoClose;
+};
+
+typedef shared_ptr<FileRegion> SpFileRegion;
+
+}
@@ -1,39 +1,269 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "BitmapTree.hpp"
 
+/**
+ * Occupancy of one arena of FixedBufferPool, slots cached by threads count as used.
+ */
+struct FixedArenaStats {
+  size_t _index;
+  size_t _capacity;   // slots of the arena
+  size_t _used;
+  size_t _bytes;      // bytes mapped
+  bool _hugeTlb;      // backed by MAP_HUGETLB pages
+};
+
 /**
  * Fixed size buffer pool implementation.
  *
  * we must garentee the ALLOC class will alloc N byte each time
  * we called alloc
+ *
+ * Pool grows by arenas of C slots on demand, up to A arenas, each arena has its own bitmap tree.
+ * Arena except the first is unmapped once all of its slots come back. Arena memory is mmaped, with
+ * hugepage backing if setHugePage(true) is called.
  */
-
-template <int C, int N>
+template <int C, int N, int A = 64>
 struct FixedBufferPool {
+  // slots cached by each thread, refill and spill half of it each time.
+  enum {MAGAZINE_SIZE = 32};
+
   static void* alloc() {
-    off64_t offset = _bmt.bitRequire();
-    if(offset >= 0) {
-      return static_cast<uint8_t*>(_poolBuf) + offset * N;
+    Magazine& mag = _magazine;
+    if(__builtin_expect((0 == mag._count), 0)) {
+      mag.refill();
+      if(0 == mag._count) {
+        return nullptr;
+      }
     }
-    return nullptr;
+    return mag._slots[--mag._count];
   }
 
   static void release(void* buf) {
     if(__builtin_expect((nullptr != buf), true)) {
-        off64_t offset = (static_cast<uint8_t*>(buf) - static_cast<uint8_t*>(_poolBuf)) / N;
-        printf("========== %p, %p \n", _poolBuf, buf);
-        _bmt.bitTurnback(offset);
+      Magazine& mag = _magazine;
+      if(__builtin_expect((MAGAZINE_SIZE == mag._count), 0)) {
+        mag.spill(MAGAZINE_SIZE / 2);
+      }
+      mag._slots[mag._count++] = buf;
     }
   }
+
+  /**
+   * Back arenas mapped later with hugepage, try MAP_HUGETLB first, then transparent hugepage.
+   */
+  static void setHugePage(bool enable) {
+    _hugePage.store(enable, std::memory_order_relaxed);
+  }
+
+  // occupancy of arenas mapped now.
+  static std::vector<FixedArenaStats> arenaStats() {
+    std::vector<FixedArenaStats> stats;
+    std::lock_guard<std::mutex> lock(_growMutex);
+    size_t count = _arenaCount.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; i++) {
+      Arena& arena = _arenas[i];
+      uint64_t state = arena._state.load(std::memory_order_relaxed);
+      if(state >= ARENA_LIVE) {
+        stats.push_back({i, static_cast<size_t>(C), static_cast<size_t>(state - ARENA_LIVE),
+                arena._mapped, arena._hugeTlb});
+      }
+    }
+    return stats;
+  }
 private:
-  static void* _poolBuf;
-  static BitmapTree _bmt;
+  /**
+   * Descriptor of an arena, never freed, only the memory behind it is mapped and unmapped. _state
+   * is slots out plus claims in flight, added with ARENA_LIVE while memory is mapped, so claim
+   * fails once arena is unmapped, and arena with nothing out can be unmapped by one CAS.
+   */
+  struct Arena {
+    std::atomic<uint64_t> _state;
+    std::atomic<uint8_t*> _base;
+    std::atomic<AtomicBitmapTree*> _bmt;
+    size_t _mapped;
+    bool _hugeTlb;
+  };
+
+  static const uint64_t ARENA_LIVE = 1ULL << 62;
+  static const size_t ARENA_BYTES = static_cast<size_t>(C) * N;
+
+  static void* claim(Arena& arena) {
+    if(arena._state.fetch_add(1, std::memory_order_acquire) < ARENA_LIVE) {
+      arena._state.fetch_sub(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    off64_t offset = arena._bmt.load(std::memory_order_relaxed)->bitRequire();
+    if(offset < 0) {
+      arena._state.fetch_sub(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return arena._base.load(std::memory_order_relaxed) + offset * N;
+  }
+
+  // first arena the slot belongs to.
+  static Arena* arenaOf(uint8_t* slot, size_t count) {
+    for(size_t i = 0; i < count; i++) {
+      uint8_t* base = _arenas[i]._base.load(std::memory_order_acquire);
+      if(nullptr != base && slot >= base && slot < base + ARENA_BYTES) {
+        return &_arenas[i];
+      }
+    }
+    return nullptr;
+  }
+
+  static void turnback(void* buf) {
+    uint8_t* slot = static_cast<uint8_t*>(buf);
+    Arena* arena = arenaOf(slot, _arenaCount.load(std::memory_order_acquire));
+    if(nullptr == arena) {
+      return;
+    }
+
+    arena->_bmt.load(std::memory_order_relaxed)->bitTurnback((slot - arena->_base.load(std::memory_order_relaxed)) / N);
+    if(ARENA_LIVE + 1 == arena->_state.fetch_sub(1, std::memory_order_release) && arena != &_arenas[0]) {
+      shrink(*arena);
+    }
+  }
+
+  // unmap arena if it's still fully free.
+  static void shrink(Arena& arena) {
+    std::lock_guard<std::mutex> lock(_growMutex);
+    uint64_t expect = ARENA_LIVE;
+    if(arena._state.compare_exchange_strong(expect, 0, std::memory_order_acquire)) {
+      uint8_t* base = arena._base.exchange(nullptr, std::memory_order_relaxed);
+      ::munmap(base, arena._mapped);
+    }
+  }
+
+  // claim a slot from arena mapped now, or map a new one.
+  static void* grow() {
+    std::lock_guard<std::mutex> lock(_growMutex);
+    size_t count = _arenaCount.load(std::memory_order_relaxed);
+    Arena* spare = nullptr;
+    for(size_t i = 0; i < count; i++) {
+      if(_arenas[i]._state.load(std::memory_order_relaxed) >= ARENA_LIVE) {
+        void* slot = claim(_arenas[i]);
+        if(nullptr != slot) {
+          return slot;
+        }
+      } else if(nullptr == spare) {
+        spare = &_arenas[i];
+      }
+    }
+
+    if(nullptr == spare) {
+      if(count == A) {
+        return nullptr;
+      }
+      spare = &_arenas[count];
+    }
+
+    if(!mapArena(*spare)) {
+      return nullptr;
+    }
+    if(nullptr == spare->_bmt.load(std::memory_order_relaxed)) {
+      spare->_bmt.store(new AtomicBitmapTree(C), std::memory_order_relaxed);
+    }
+    if(spare == &_arenas[count]) {
+      _arenaCount.store(count + 1, std::memory_order_release);
+    }
+    // publish base and bitmap, keep claims failed on the dead arena counted.
+    spare->_state.fetch_add(ARENA_LIVE, std::memory_order_release);
+    return claim(*spare);
+  }
+
+  static bool mapArena(Arena& arena) {
+    const size_t hugeSize = 2 * 1024 * 1024;
+    const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    void* base = MAP_FAILED;
+    bool huge = _hugePage.load(std::memory_order_relaxed);
+    size_t bytes = (ARENA_BYTES + pageSize - 1) / pageSize * pageSize;
+
+    arena._hugeTlb = false;
+    if(huge) {
+      size_t hugeBytes = (ARENA_BYTES + hugeSize - 1) / hugeSize * hugeSize;
+      base = ::mmap(nullptr, hugeBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(MAP_FAILED != base) {
+        bytes = hugeBytes;
+        arena._hugeTlb = true;
+      }
+    }
+
+    if(MAP_FAILED == base) {
+      base = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(MAP_FAILED == base) {
+        return false;
+      }
+      if(huge) {
+        ::madvise(base, bytes, MADV_HUGEPAGE);
+      }
+    }
+
+    arena._mapped = bytes;
+    arena._base.store(static_cast<uint8_t*>(base), std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * Per thread stack of free slots in front of the arenas, alloc/free pair in the same thread
+   * only touches it. Slots left are given back when thread exits.
+   */
+  struct Magazine {
+    Magazine() : _count(0) {}
+    ~Magazine() {
+      spill(_count);
+    }
+
+    // take slots from arenas in order, so later arenas tend to drain and get unmapped.
+    void refill() {
+      size_t count = _arenaCount.load(std::memory_order_acquire);
+      for(size_t i = 0; i < count && _count < MAGAZINE_SIZE / 2; i++) {
+        void* slot;
+        while(_count < MAGAZINE_SIZE / 2 && nullptr != (slot = claim(_arenas[i]))) {
+          _slots[_count++] = slot;
+        }
+      }
+
+      if(0 == _count) {
+        void* slot = grow();
+        if(nullptr != slot) {
+          _slots[_count++] = slot;
+        }
+      }
+    }
+
+    void spill(size_t count) {
+      for(size_t i = 0; i < count; i++) {
+        turnback(_slots[--_count]);
+      }
+    }
+
+    void* _slots[MAGAZINE_SIZE];
+    size_t _count;
+  };
+
+  static Arena _arenas[A];
+  // descriptors ever used.
+  static std::atomic<size_t> _arenaCount;
+  static std::atomic<bool> _hugePage;
+  static std::mutex _growMutex;
+  static thread_local Magazine _magazine;
 };
 
-template<int C, int N> void* FixedBufferPool<C, N>::_poolBuf = malloc(C * N);
-template<int C, int N> BitmapTree FixedBufferPool<C, N>::_bmt(C);
+template<int C, int N, int A> const uint64_t FixedBufferPool<C, N, A>::ARENA_LIVE;
+template<int C, int N, int A> const size_t FixedBufferPool<C, N, A>::ARENA_BYTES;
+template<int C, int N, int A> typename FixedBufferPool<C, N, A>::Arena FixedBufferPool<C, N, A>::_arenas[A];
+template<int C, int N, int A> std::atomic<size_t> FixedBufferPool<C, N, A>::_arenaCount(0);
+template<int C, int N, int A> std::atomic<bool> FixedBufferPool<C, N, A>::_hugePage(false);
+template<int C, int N, int A> std::mutex FixedBufferPool<C, N, A>::_growMutex;
+template<int C, int N, int A> thread_local typename FixedBufferPool<C, N, A>::Magazine FixedBufferPool<C, N, A>::_magazine;
 
 template <int C, int N, typename ALLOC=FixedBufferPool<C, N> >
 class FixedBuffer {
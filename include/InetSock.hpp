@@ -5,6 +5,7 @@
 #include <sys/types.h>          /* See NOTES */
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 
 #include "InetAddr.hpp"
 #include "Endian.hpp"
@@ -21,6 +22,8 @@ class InetSock {
   
   void enableReuseAddr(bool enable);
   void enableReusePort(bool enable);
+  // SO_ZEROCOPY, return 0 on success, -1 if not supported.
+  int enableZeroCopy(bool enable);
 
   void setNonblocking(bool enable);
 
@@ -74,6 +77,12 @@ class StreamSocket : public InetSock {
    */
   explicit StreamSocket(uint16_t port);
 
+  /**
+   * For server socket, enable SO_REUSEADDR and SO_REUSEPORT before bind, so several
+   * sockets can listen on the same port and kernel balance connections among them.
+   */
+  StreamSocket(uint16_t port, bool reusePort);
+
   /**
    * For server socket or client socket.
    */
@@ -90,6 +99,14 @@ class StreamSocket : public InetSock {
     return ::recv(_fd, buf, len, flags);
   }
 
+  ssize_t write(const void* buf, size_t len) {
+    return ::write(_fd, buf, len);
+  }
+
+  ssize_t sendfile(int inFd, off_t* offset, size_t count) {
+    return ::sendfile(_fd, inFd, offset, count);
+  }
+
   ssize_t writev(const struct iovec* iov, int iovcnt) {
     return ::writev(_fd, iov, iovcnt);
   }
@@ -119,10 +136,16 @@ class ServerSocket : public StreamSocket {
  public:
   ServerSocket(int fd) : StreamSocket(fd) {};
   explicit ServerSocket(uint16_t port) : StreamSocket(port) {};
+  ServerSocket(uint16_t port, bool reusePort) : StreamSocket(port, reusePort) {};
   ServerSocket(const struct sockaddr_in& sockaddr) : StreamSocket(sockaddr) {};
   
   int listen(int backlog = SOMAXCONN);
   int accept(const struct sockaddr_in& clientaddr);
+
+  /**
+   * accept with flags (SOCK_NONBLOCK, SOCK_CLOEXEC) applied to the new fd atomically.
+   */
+  int accept4(struct sockaddr_in& clientaddr, int flags);
 };
 
 /**
@@ -1,66 +1,350 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
+#include <future>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 #include "Logger.hpp"
 
 using namespace std;
 namespace netio {
 
+/**
+ * Placement of looper threads.
+ *
+ * _cpuSets : cpu set for each looper, looper i is pinned to _cpuSets[i % size]. Empty for no pinning.
+ * _namePrefix : looper thread is named "<prefix>-<index>", empty for not naming.
+ */
+struct LooperPlacement {
+  LooperPlacement() : _cpuSets(), _namePrefix("looper") {}
+
+  /**
+   * Pin one looper on each cpu of the list.
+   */
+  static LooperPlacement perCpu(const vector<int>& cpus) {
+    LooperPlacement placement;
+    for(size_t i = 0; i < cpus.size(); i++) {
+      placement._cpuSets.push_back(vector<int>(1, cpus[i]));
+    }
+    return placement;
+  }
+
+  vector<vector<int> > _cpuSets;
+  string _namePrefix;
+};
+
+/**
+ * Strategy of picking looper for new work.
+ *
+ * SELECT_ROUND_ROBIN : rotate over loopers.
+ * SELECT_LEAST_CONNECTIONS : looper with the least connections.
+ * SELECT_LEAST_PENDING : looper with the least runnables waiting to be executed.
+ * SELECT_POWER_OF_TWO : pick two loopers randomly, take the one with lower load counter.
+ */
+typedef enum {
+  SELECT_ROUND_ROBIN = 0,
+  SELECT_LEAST_CONNECTIONS,
+  SELECT_LEAST_PENDING,
+  SELECT_POWER_OF_TWO
+} LooperSelectStrategy;
+
+/**
+ * Looper provides load metrics (connectionCount, pendingRunnables and loadCounter) or not.
+ */
+template <class Looper>
+class LooperLoadTraits {
+  template <class T>
+  static auto check(int) -> decltype(declval<const T&>().connectionCount(),
+                                     declval<const T&>().pendingRunnables(),
+                                     declval<const T&>().loadCounter(),
+                                     true_type());
+  template <class T>
+  static false_type check(...);
+ public:
+  static const bool value = decltype(check<Looper>(0))::value;
+};
+
 /**
  * Looper class must have startLoop and stopLoop member function.
+ * Load aware strategies need connectionCount, pendingRunnables and loadCounter too, loopers without
+ * them are always selected by round robin.
+ *
+ * Looper is constructed by its own thread after the thread is pinned, so memory of looper
+ * (and everything looper thread allocates later) is first touched on local NUMA node.
  */
 template <class Looper>
 class LooperPool {
+  struct LooperSlot {
+    Looper* _looper;
+    thread* _thread;
+    int _node;    // NUMA node of the looper, -1 if looper is not pinned.
+  };
+
+  // loopers a selection choose from.
+  struct NodeGroup {
+    NodeGroup() : _indexes(), _cursor(0) {}
+    vector<size_t> _indexes;
+    atomic<size_t> _cursor;
+  };
  public:
+  // custom selector, return one of the candidate looper index.
+  typedef function<size_t(const LooperPool&, const vector<size_t>& candidates)> Selector;
+
   LooperPool(size_t threadCount, bool attach = true) :
+      LooperPool(threadCount, LooperPlacement(), attach)
+  {}
+
+  LooperPool(size_t threadCount, const LooperPlacement& placement, bool attach = true) :
       _loopers(),
       _attach(attach),
-      _lastLooperIdx(0)
+      _strategy(SELECT_ROUND_ROBIN)
   {
     LOGI(LOG_NETIO_TAG, "LooperPool initial thread count %d", threadCount);
-    
-    for(int i = 0; i < threadCount; i++) {
-      Looper* looper = new Looper();
-      thread* mythread = new thread(std::bind(&Looper::startLoop, looper));
+
+    for(size_t i = 0; i < threadCount; i++) {
+      const vector<int>* cpus = placement._cpuSets.empty() ? nullptr : &placement._cpuSets[i % placement._cpuSets.size()];
+      promise<LooperSlot> created;
+      future<LooperSlot> result = created.get_future();
+      // looper thread owns the promise, it must outlive set_value.
+      thread* mythread = new thread(&LooperPool::runLooper, i, cpus, placement._namePrefix, std::move(created));
+
+      LooperSlot slot = result.get();
+      slot._thread = mythread;
 
       //      LOGD(LOG_NETIO_TAG, "initial loop pool, index=%d threadid=0x%X", i, mythread->get_id());
 
       if(!_attach) {
         mythread->detach();
       }
-      
-      auto loopMap = make_pair(looper, mythread);
-      _loopers.push_back(loopMap);
+
+      if(slot._node >= 0) {
+        _nodeGroups[slot._node]._indexes.push_back(i);
+      }
+      _allLoopers._indexes.push_back(i);
+      _loopers.push_back(slot);
     }
   }
 
   ~LooperPool() {
-    for(int i = 0; i < _loopers.size(); i++) {
-      _loopers[i].first->stopLoop();
+    for(size_t i = 0; i < _loopers.size(); i++) {
+      _loopers[i]._looper->stopLoop();
       if(_attach) {
-        _loopers[i].second->join();
+        _loopers[i]._thread->join();
         LOGI(LOG_NETIO_TAG, "looper thread joined");
       }
 
-      delete _loopers[i].second;
-      delete _loopers[i].first;
+      delete _loopers[i]._thread;
+      delete _loopers[i]._looper;
     }
 
   }
-  
+
+  /**
+   * Set strategy for getLooper and getLooperOnNode, must be set before loopers are used.
+   */
+  void setSelectStrategy(LooperSelectStrategy strategy) {
+    _strategy = strategy;
+    _selector = nullptr;
+  }
+
+  /**
+   * Plug in custom selector, it overrides the strategy.
+   */
+  void setSelector(const Selector& selector) {
+    _selector = selector;
+  }
+
+  /**
+   * Pick a looper by select strategy, thread safe.
+   */
   Looper* getLooper() {
-    Looper* looper = _loopers[_lastLooperIdx].first;
-    _lastLooperIdx = ((_lastLooperIdx + 1) % _loopers.size());
-    return looper;
+    return _loopers[select(_allLoopers)]._looper;
+  }
+
+  /**
+   * Get looper located on the NUMA node, fallback to getLooper if there is no looper pinned on the node.
+   */
+  Looper* getLooperOnNode(int node) {
+    auto iter = _nodeGroups.find(node);
+    if(iter == _nodeGroups.end()) {
+      return getLooper();
+    }
+
+    return _loopers[select(iter->second)]._looper;
+  }
+
+  size_t size() const {
+    return _loopers.size();
+  }
+
+  Looper* getLooperAt(size_t index) const {
+    return _loopers[index]._looper;
+  }
+
+  /**
+   * Index of the looper in pool, size() if not found.
+   */
+  size_t indexOf(const Looper* looper) const {
+    for(size_t i = 0; i < _loopers.size(); i++) {
+      if(_loopers[i]._looper == looper) {
+        return i;
+      }
+    }
+    return _loopers.size();
+  }
+
+  /**
+   * NUMA node of looper at index, -1 if the looper is not pinned.
+   */
+  int getLooperNode(size_t index) const {
+    return _loopers[index]._node;
+  }
+
+  /**
+   * NUMA node of the cpu calling thread is running on.
+   */
+  static int currentNode() {
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if(0 != syscall(SYS_getcpu, &cpu, &node, nullptr)) {
+      return -1;
+    }
+    return static_cast<int>(node);
   }
 
  private:
-  vector<pair<Looper*, thread*> > _loopers;
+  size_t select(NodeGroup& group) {
+    const vector<size_t>& indexes = group._indexes;
+
+    if(_selector) {
+      return _selector(*this, indexes);
+    }
+
+    if(UNLIKELY(1 == indexes.size())) {
+      return indexes[0];
+    }
+
+    size_t index;
+    if(SELECT_ROUND_ROBIN != _strategy
+       && selectByLoad(indexes, index, integral_constant<bool, LooperLoadTraits<Looper>::value>())) {
+      return index;
+    }
+    return indexes[group._cursor.fetch_add(1, memory_order_relaxed) % indexes.size()];
+  }
+
+  // pick by load aware strategy, false if strategy is not load aware.
+  bool selectByLoad(const vector<size_t>& indexes, size_t& index, true_type) const {
+    switch(_strategy) {
+      case SELECT_LEAST_CONNECTIONS:
+        index = selectLeast(indexes, [] (const Looper* looper) { return static_cast<uint64_t>(looper->connectionCount()); });
+        return true;
+      case SELECT_LEAST_PENDING:
+        index = selectLeast(indexes, [] (const Looper* looper) { return static_cast<uint64_t>(looper->pendingRunnables()); });
+        return true;
+      case SELECT_POWER_OF_TWO:
+        index = selectPowerOfTwo(indexes);
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // looper has no load metrics.
+  bool selectByLoad(const vector<size_t>&, size_t&, false_type) const {
+    return false;
+  }
+
+  template <typename Metric>
+  size_t selectLeast(const vector<size_t>& indexes, Metric metric) const {
+    size_t best = indexes[0];
+    uint64_t bestValue = metric(_loopers[best]._looper);
+
+    for(size_t i = 1; i < indexes.size(); i++) {
+      uint64_t value = metric(_loopers[indexes[i]]._looper);
+      if(value < bestValue) {
+        best = indexes[i];
+        bestValue = value;
+      }
+    }
+    return best;
+  }
+
+  size_t selectPowerOfTwo(const vector<size_t>& indexes) const {
+    static __thread uint64_t seed = 0;
+    if(UNLIKELY(0 == seed)) {
+      seed = reinterpret_cast<uintptr_t>(&seed) | 1;
+    }
+
+    // xorshift64
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    size_t pos1 = seed % indexes.size();
+    size_t pos2 = (seed >> 32) % (indexes.size() - 1);
+    // make two choices distinct
+    if(pos2 >= pos1) {
+      pos2++;
+    }
+
+    size_t first = indexes[pos1];
+    size_t second = indexes[pos2];
+
+    const Looper* a = _loopers[first]._looper;
+    const Looper* b = _loopers[second]._looper;
+    uint64_t loadA = a->loadCounter() + a->pendingRunnables();
+    uint64_t loadB = b->loadCounter() + b->pendingRunnables();
+    return (loadB < loadA) ? second : first;
+  }
+
+  static void runLooper(size_t index, const vector<int>* cpus, const string& namePrefix, promise<LooperSlot> created) {
+    LooperSlot slot = {nullptr, nullptr, -1};
+
+    if(!namePrefix.empty()) {
+      char name[16]; // linux limit thread name to 16 bytes, include '\0'
+      snprintf(name, sizeof(name), "%s-%zu", namePrefix.c_str(), index);
+      pthread_setname_np(pthread_self(), name);
+    }
+
+    if(nullptr != cpus && !cpus->empty()) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      for(size_t i = 0; i < cpus->size(); i++) {
+        CPU_SET((*cpus)[i], &cpuset);
+      }
+
+      int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+      if(0 == ret) {
+        slot._node = currentNode();
+      } else {
+        LOGW(LOG_NETIO_TAG, "LooperPool pin looper %d failed, msg=%s", index, strerror(ret));
+      }
+    }
+
+    // construct looper after pinned, let memory allocate on local node.
+    Looper* looper = new Looper();
+    slot._looper = looper;
+    created.set_value(slot);
+
+    looper->startLoop();
+  }
+
+  vector<LooperSlot> _loopers;
+  NodeGroup _allLoopers;
+  map<int, NodeGroup> _nodeGroups;
   bool _attach;
-  size_t _lastLooperIdx;
+  LooperSelectStrategy _strategy;
+  Selector _selector;
 };
 
 }
@@ -74,4 +358,3 @@ class LooperPool {
 
 
 
-
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+#include "Utils.hpp"
+
+using namespace std;
+
+namespace netio {
+
+const size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * Link hook for MpscQueue, element type must derive from it.
+ */
+struct MpscNode {
+  MpscNode() : _next(nullptr) {}
+  atomic<MpscNode*> _next;
+};
+
+/**
+ * Intrusive multi-producer single-consumer queue (Dmitry Vyukov's algorithm).
+ *
+ * push is wait free and may be called from any thread, pop must only be called by the consumer thread.
+ * The queue never allocates, element T must derive from MpscNode and the memory is managed by caller.
+ *
+ * NOTE : pop may return nullptr while a producer is between swapping head and linking its node,
+ * producers should notify the consumer after push, so the consumer will come back and pop it later.
+ */
+template <class T>
+class MpscQueue {
+ public:
+  MpscQueue() : _head(&_stub), _tail(&_stub) {}
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator= (const MpscQueue&) = delete;
+
+  /**
+   * push node to the queue, called by producers.
+   */
+  void push(T* node) {
+    pushNode(static_cast<MpscNode*>(node));
+  }
+
+  /**
+   * pop node from the queue, called by consumer only.
+   *
+   * @return : the first node, or nullptr if queue is empty or the first node is not linked yet.
+   */
+  T* pop() {
+    MpscNode* tail = _tail;
+    MpscNode* next = tail->_next.load(memory_order_acquire);
+
+    // skip the stub node
+    if(tail == &_stub) {
+      if(nullptr == next) {
+        return nullptr;
+      }
+      _tail = next;
+      tail = next;
+      next = next->_next.load(memory_order_acquire);
+    }
+
+    if(nullptr != next) {
+      _tail = next;
+      return static_cast<T*>(tail);
+    }
+
+    // a producer swapped head but not linked yet.
+    if(tail != _head.load(memory_order_acquire)) {
+      return nullptr;
+    }
+
+    // tail is the last node, push stub back so we can take the tail out.
+    pushNode(&_stub);
+
+    next = tail->_next.load(memory_order_acquire);
+    if(nullptr != next) {
+      _tail = next;
+      return static_cast<T*>(tail);
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * Check if queue is empty, only accurate when called by consumer.
+   */
+  bool empty() const {
+    return (_tail == &_stub) && (nullptr == _stub._next.load(memory_order_acquire))
+        && (_head.load(memory_order_acquire) == &_stub);
+  }
+
+ private:
+  void pushNode(MpscNode* node) {
+    node->_next.store(nullptr, memory_order_relaxed);
+    MpscNode* prev = _head.exchange(node, memory_order_acq_rel);
+    prev->_next.store(node, memory_order_release);
+  }
+
+  // padding instead of alignas, over-aligned owner can't be allocated by operator new before c++17.
+  char _padHead[CACHE_LINE_SIZE];
+  // producers side, keep it away from consumer's cache line.
+  atomic<MpscNode*> _head;
+  char _padTail[CACHE_LINE_SIZE - sizeof(atomic<MpscNode*>)];
+  // consumer side
+  MpscNode* _tail;
+  MpscNode _stub;
+};
+
+}
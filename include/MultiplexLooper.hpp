@@ -7,12 +7,15 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/eventfd.h>
+#include <atomic>
 #include <map>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "Utils.hpp"
 #include "Channel.hpp"
+#include "MpscQueue.hpp"
 #include "Logger.hpp"
 
 using namespace std;
@@ -23,7 +26,8 @@ class EventChannel {
   typedef function<void(void)> EventHandler;
  public:
   EventChannel(MultiplexLooper* looper) : 
-	_evfd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), _channel(looper, _evfd)
+	_evfd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), _channel(looper, _evfd),
+    _pending(false), _issued(0), _suppressed(0)
   {
 	ASSERT(_evfd >= 0);
     _channel.setReadCallback(std::bind(&EventChannel::handleRead, this));
@@ -36,7 +40,17 @@ class EventChannel {
     ::close(_evfd);
   }
   
+  /**
+   * Signal the looper. Only the first wakeup after a drain writes eventfd, the others
+   * are coalesced until handleRead clears the pending flag.
+   */
   void wakeup() {
+    if(_pending.exchange(true, memory_order_acq_rel)) {
+      _suppressed.fetch_add(1, memory_order_relaxed);
+      return;
+    }
+
+    _issued.fetch_add(1, memory_order_relaxed);
 	int64_t value = 1;
     CHKRET(::write(_evfd, &value, sizeof(value)));
   }
@@ -44,6 +58,9 @@ class EventChannel {
   void handleRead() {
 	int64_t value;
     CHKRET(::read(_evfd, &value, sizeof(value)));
+
+    // clear pending flag before handling, any wakeup from now on must signal again.
+    _pending.exchange(false, memory_order_acq_rel);
 	
 	if(_handleEvent) {
 	  _handleEvent();
@@ -58,15 +75,61 @@ class EventChannel {
 	_handleEvent = std::move(eventHandler);
   }
 
+  // how many wakeups really write eventfd.
+  uint64_t wakeupsIssued() const { return _issued.load(memory_order_relaxed); }
+  // how many wakeups coalesced because looper was signaled and not drained.
+  uint64_t wakeupsSuppressed() const { return _suppressed.load(memory_order_relaxed); }
+
  private:
   // we use eventfd for epoll event notify.
   int _evfd;
   Channel _channel;
   EventHandler _handleEvent;
+
+  // set when eventfd was written and not read yet.
+  atomic<bool> _pending;
+  atomic<uint64_t> _issued;
+  atomic<uint64_t> _suppressed;
 };
 
 
 
+/**
+ * Loop policy of MultiplexLooper, must be set before startLoop.
+ *
+ * _initEvents : initial size of epoll event array.
+ * _maxEvents  : event array doubles when a wakeup fills it, until reach this size. It shrinks back
+ *               toward _initEvents when the batch keeps mostly empty.
+ * _busyPollUs : if positive, spin on epoll_wait with zero timeout for at most this microseconds
+ *               before blocking, trade cpu for latency on pinned looper.
+ */
+struct LoopPolicy {
+  LoopPolicy() :
+      _initEvents(20),
+      _maxEvents(1024),
+      _busyPollUs(0)
+  {}
+
+  size_t _initEvents;
+  size_t _maxEvents;
+  uint32_t _busyPollUs;
+};
+
+/**
+ * Snapshot of looper statistics.
+ */
+struct LoopStats {
+  uint64_t _wakeups;      // epoll_wait returns with events
+  uint64_t _events;       // total events dispatched
+  uint64_t _busyPollHits; // wakeups satisfied during busy poll phase
+  uint64_t _idleUs;       // time spent waiting for events, busy poll included
+  size_t _batchSize;      // current size of event array
+
+  double eventsPerWakeup() const {
+    return _wakeups ? static_cast<double>(_events) / _wakeups : 0;
+  }
+};
+
 /**
  * Multiplex looper.
  *
@@ -77,8 +140,23 @@ class MultiplexLooper {
   //  friend class EventChannel;
  public:
   MultiplexLooper();
+  explicit MultiplexLooper(const LoopPolicy& policy);
   ~MultiplexLooper();
 
+  /**
+   * Set loop policy, must be called before startLoop.
+   */
+  void setLoopPolicy(const LoopPolicy& policy);
+
+  const LoopPolicy& getLoopPolicy() const {
+    return _policy;
+  }
+
+  /**
+   * Get statistics of the loop, can be called from any thread.
+   */
+  LoopStats getLoopStats() const;
+
   /**
    * Add channel to be managed by the poller.
    */
@@ -117,15 +195,35 @@ class MultiplexLooper {
     _wakeupChan->wakeup();
   }
 
+  /**
+   * Wakeup counters of runnable channel, for observing the syscall saved by coalescing.
+   */
+  uint64_t wakeupsIssued() const { return _runnableChan->wakeupsIssued(); }
+  uint64_t wakeupsSuppressed() const { return _runnableChan->wakeupsSuppressed(); }
+
+  /**
+   * Load metrics for looper selection, maintained atomically and can be read from any thread.
+   *
+   * connectionCount : connections owned by this looper.
+   * pendingRunnables : runnables posted from other threads and not executed yet.
+   * loadCounter : events dispatched recently, halved every LOAD_HALF_LIFE_US.
+   */
+  void incConnection() { _connections.fetch_add(1, memory_order_relaxed); }
+  void decConnection() { _connections.fetch_sub(1, memory_order_relaxed); }
+  size_t connectionCount() const { return _connections.load(memory_order_relaxed); }
+  size_t pendingRunnables() const { return _pendingRunnables.load(memory_order_relaxed); }
+  uint64_t loadCounter() const;
+
+  // called in the looper thread or not.
+  bool inLooperThread() const {
+    return this_thread::get_id() == _threadId;
+  }
+
   void postRunnable(Runnable& runnable) {
     if(this_thread::get_id() == _threadId) {
       runnable();
     } else {
-      {
-        unique_lock<mutex> lock(_rqMutex);
-        _runnables.push_back(runnable);
-      }
-      _runnableChan->wakeup();
+      enqueueRunnable(new RunnableNode(runnable));
     }
   }
 
@@ -133,28 +231,31 @@ class MultiplexLooper {
     if(this_thread::get_id() == _threadId) {
       runnable();
     } else {
-      {
-        unique_lock<mutex> lock(_rqMutex);
-        _runnables.push_back(std::move(runnable));
-      }
-      _runnableChan->wakeup();
+      enqueueRunnable(new RunnableNode(std::move(runnable)));
     }
   }
 
+  /**
+   * Run task at the end of current loop iteration, after all events of the iteration are dispatched.
+   * Looper thread only. Tasks added while running them are run at the end of next iteration,
+   * and next poll won't block.
+   */
+  void runAfterIteration(const Runnable& task) {
+    ASSERT(this_thread::get_id() == _threadId);
+    _afterTasks.push_back(task);
+  }
+
+  void runAfterIteration(Runnable&& task) {
+    ASSERT(this_thread::get_id() == _threadId);
+    _afterTasks.push_back(std::move(task));
+  }
+
   void postRunnablePopStack(Runnable& runnable) {
-    {
-      unique_lock<mutex> lock(_rqMutex);
-      _runnables.push_back(runnable);
-    }
-    _runnableChan->wakeup();
+    enqueueRunnable(new RunnableNode(runnable));
   }
 
   void postRunnablePopStack(Runnable&& runnable) {
-    {
-      unique_lock<mutex> lock(_rqMutex);
-      _runnables.push_back(std::move(runnable));
-    }
-    _runnableChan->wakeup();    
+    enqueueRunnable(new RunnableNode(std::move(runnable)));
   }
 
 
@@ -168,18 +269,41 @@ class MultiplexLooper {
     ASSERT(ret >= 0);
   }
 
-  void executeRunnables() {
-    vector<Runnable> runnables;
+  // runnable wrapper that can be linked into the lock-free queue.
+  struct RunnableNode : public MpscNode {
+    explicit RunnableNode(const Runnable& runnable) : _runnable(runnable) {}
+    explicit RunnableNode(Runnable&& runnable) : _runnable(std::move(runnable)) {}
+    Runnable _runnable;
+  };
 
-    {
-      unique_lock<mutex> lock(_rqMutex);
-      runnables.swap(_runnables);
-    }
+  // max runnables executed in one drain, we don't starve io events when producers are busy.
+  static const size_t RUNNABLE_BATCH = 1024;
 
-    for(size_t i = 0; i < runnables.size(); i++) {
-      runnables[i]();
-    }
+  void enqueueRunnable(RunnableNode* node) {
+    _pendingRunnables.fetch_add(1, memory_order_relaxed);
+    _runnables.push(node);
+    _runnableChan->wakeup();
   }
+
+  void executeRunnables();
+  void runAfterTasks();
+
+  // wait for events, with busy poll phase if policy required.
+  int pollEvents(vector<struct epoll_event>& events);
+
+  // loop thread is the only writer, avoid locked instruction for statistics.
+  static void statAdd(atomic<uint64_t>& stat, uint64_t value) {
+    stat.store(stat.load(memory_order_relaxed) + value, memory_order_relaxed);
+  }
+
+  // decay load counter and add events of this wakeup.
+  void updateLoad(int evCount);
+
+  // batch shrink if events fill less than quarter of array for this many rounds.
+  static const size_t BATCH_SHRINK_ROUNDS = 64;
+
+  // load counter decay period.
+  static const uint64_t LOAD_HALF_LIFE_US = 100000;
   
   // epoll fd;
   int _pollFd;
@@ -188,16 +312,37 @@ class MultiplexLooper {
   // use for debug.
   map<int, Channel*> _chanMap;
   
-  // function scadualer
+  // function scadualer, producers push runnable without lock, drained by looper thread.
   EventChannel* _runnableChan;
-  vector<Runnable> _runnables;
-  mutable mutex _rqMutex;
+  MpscQueue<RunnableNode> _runnables;
+
+  // tasks run at the end of iteration, looper thread only.
+  vector<Runnable> _afterTasks;
+  vector<Runnable> _runningTasks;
 
   // Use for manage the looper, use internal.
   EventChannel* _wakeupChan;
   
   volatile bool _looping;
   thread::id _threadId;
+
+  LoopPolicy _policy;
+
+  // statistics, written by looper thread only.
+  atomic<uint64_t> _statWakeups;
+  atomic<uint64_t> _statEvents;
+  atomic<uint64_t> _statBusyPollHits;
+  atomic<uint64_t> _statIdleUs;
+  atomic<size_t> _statBatchSize;
+
+  // time when last epoll_wait returned, looper thread only.
+  uint64_t _wakeStampUs;
+
+  // load metrics
+  atomic<size_t> _connections;
+  atomic<size_t> _pendingRunnables;
+  atomic<uint64_t> _load;
+  atomic<uint64_t> _loadStampUs;
 };
 
 }
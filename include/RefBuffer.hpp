@@ -0,0 +1,203 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+#include "Utils.hpp"
+#include "BufferPool.hpp"
+#include "VecBuffer.hpp"
+
+using namespace std;
+
+namespace netio {
+
+/**
+ * Reference count for buffer used by only one thread, e.g. confined to one looper.
+ */
+class LocalRefCount {
+ public:
+  LocalRefCount() : _count(1) {}
+  void retain() { _count++; }
+  // return true if it was the last reference.
+  bool release() { return 0 == --_count; }
+  size_t count() const { return _count; }
+ private:
+  size_t _count;
+};
+
+/**
+ * Reference count for buffer shared between threads.
+ */
+class AtomicRefCount {
+ public:
+  AtomicRefCount() : _count(1) {}
+  void retain() { _count.fetch_add(1, memory_order_relaxed); }
+  bool release() { return 1 == _count.fetch_sub(1, memory_order_acq_rel); }
+  size_t count() const { return _count.load(memory_order_relaxed); }
+ private:
+  atomic<size_t> _count;
+};
+
+/**
+ * Buffer handle with intrusive reference count.
+ *
+ * Reference count and payload are in one block from BufferPool, the handle holds the block pointer with
+ * offset and length of its own view, copy or split only touches one count, no extra indirection.
+ * It works like VecBuffer : write to the tail, read from the head, split shares the same block.
+ *
+ * RefPolicy is LocalRefCount or AtomicRefCount, handles and their splits must not cross thread
+ * with LocalRefCount.
+ */
+template <class RefPolicy>
+class BasicRefBuffer {
+  // header of the block, payload follows.
+  struct alignas(16) Block {
+    explicit Block(size_t capacity) : _refs(), _capacity(capacity) {}
+    RefPolicy _refs;
+    size_t _capacity;
+
+    CharType* payload() {
+      return reinterpret_cast<CharType*>(this + 1);
+    }
+  };
+ public:
+  BasicRefBuffer() : _block(nullptr), _offset(0), _len(0) {}
+
+  explicit BasicRefBuffer(size_t capacity) :
+      _block(::new(BufferPool::allocate(sizeof(Block) + capacity)) Block(capacity)),
+      _offset(0),
+      _len(0)
+  {}
+
+  BasicRefBuffer(const BasicRefBuffer& other) :
+      _block(other._block),
+      _offset(other._offset),
+      _len(other._len)
+  {
+    if(nullptr != _block) {
+      _block->_refs.retain();
+    }
+  }
+
+  BasicRefBuffer(BasicRefBuffer&& other) :
+      _block(other._block),
+      _offset(other._offset),
+      _len(other._len)
+  {
+    other._block = nullptr;
+    other._offset = 0;
+    other._len = 0;
+  }
+
+  ~BasicRefBuffer() {
+    reset();
+  }
+
+  BasicRefBuffer& operator= (BasicRefBuffer other) {
+    swap(other);
+    return *this;
+  }
+
+  void swap(BasicRefBuffer& other) {
+    std::swap(_block, other._block);
+    std::swap(_offset, other._offset);
+    std::swap(_len, other._len);
+  }
+
+  // drop reference, handle becomes empty.
+  void reset() {
+    if(nullptr != _block && _block->_refs.release()) {
+      _block->~Block();
+      BufferPool::deallocate(_block);
+    }
+    _block = nullptr;
+    _offset = 0;
+    _len = 0;
+  }
+
+  explicit operator bool() const {
+    return nullptr != _block;
+  }
+
+  // handles referencing the same block.
+  size_t useCount() const {
+    return (nullptr != _block) ? _block->_refs.count() : 0;
+  }
+
+  size_t capacity() const {
+    return (nullptr != _block) ? _block->_capacity : 0;
+  }
+
+  size_t writtableSize() const {
+    return capacity() - (_offset + _len);
+  }
+
+  size_t readableSize() const {
+    return _len;
+  }
+
+  CharType* writtablePtr() {
+    return _block->payload() + _offset + _len;
+  }
+
+  const CharType* readablePtr() const {
+    return _block->payload() + _offset;
+  }
+
+  CharType* readablePtr() {
+    return _block->payload() + _offset;
+  }
+
+  /**
+   * mark append size readed.
+   */
+  void markRead(size_t size) {
+    ASSERT(size <= readableSize());
+    _offset += size;
+    _len -= size;
+  }
+
+  /**
+   * mark append size written.
+   */
+  void markWrite(size_t size) {
+    ASSERT(size <= writtableSize());
+    _len += size;
+  }
+
+  /**
+   * Split buffer, zero copy.
+   *
+   * If there is enough readable size for split, return splited buffer and fix _offset and _len.
+   * Otherwize return empty handle.
+   */
+  BasicRefBuffer split(size_t size) {
+    if(nullptr == _block || _len < size) {
+      return BasicRefBuffer();
+    }
+
+    _block->_refs.retain();
+    BasicRefBuffer splited(_block, _offset, size);
+    markRead(size);
+    return splited;
+  }
+
+ private:
+  // take a reference already retained.
+  BasicRefBuffer(Block* block, size_t offset, size_t len) :
+      _block(block),
+      _offset(offset),
+      _len(len)
+  {}
+
+  Block* _block;
+  size_t _offset;
+  size_t _len;
+};
+
+typedef BasicRefBuffer<LocalRefCount> LocalRefBuffer;
+typedef BasicRefBuffer<AtomicRefCount> RefBuffer;
+
+}
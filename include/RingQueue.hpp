@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+#include "Utils.hpp"
+
+using namespace std;
+
+namespace netio {
+
+/**
+ * Growable ring queue of elements, capacity is always power of two.
+ *
+ * Elements are stored in one contiguous array, so push/pop don't allocate unless the queue grows.
+ *
+ * NOTE : ring queue is not design for threading safe, it's owned by one thread.
+ */
+template <class T>
+class RingQueue {
+ public:
+  explicit RingQueue(size_t capacity = 16) :
+      _items(roundUp(capacity)),
+      _head(0),
+      _size(0)
+  {}
+
+  size_t size() const {
+    return _size;
+  }
+
+  bool empty() const {
+    return 0 == _size;
+  }
+
+  size_t capacity() const {
+    return _items.size();
+  }
+
+  T& front() {
+    ASSERT(_size > 0);
+    return _items[_head];
+  }
+
+  T& back() {
+    ASSERT(_size > 0);
+    return _items[(_head + _size - 1) & mask()];
+  }
+
+  // the index-th element from head.
+  T& operator[] (size_t index) {
+    ASSERT(index < _size);
+    return _items[(_head + index) & mask()];
+  }
+
+  const T& operator[] (size_t index) const {
+    ASSERT(index < _size);
+    return _items[(_head + index) & mask()];
+  }
+
+  void push_back(const T& item) {
+    if(UNLIKELY(_size == _items.size())) {
+      grow();
+    }
+    _items[(_head + _size) & mask()] = item;
+    _size++;
+  }
+
+  void push_back(T&& item) {
+    if(UNLIKELY(_size == _items.size())) {
+      grow();
+    }
+    _items[(_head + _size) & mask()] = std::move(item);
+    _size++;
+  }
+
+  void push_front(const T& item) {
+    if(UNLIKELY(_size == _items.size())) {
+      grow();
+    }
+    _head = (_head - 1) & mask();
+    _items[_head] = item;
+    _size++;
+  }
+
+  // pop head element, reset the slot so referenced resource is released at once.
+  void pop_front() {
+    ASSERT(_size > 0);
+    _items[_head] = T();
+    _head = (_head + 1) & mask();
+    _size--;
+  }
+
+  void clear() {
+    while(!empty()) {
+      pop_front();
+    }
+    _head = 0;
+  }
+
+ private:
+  size_t mask() const {
+    return _items.size() - 1;
+  }
+
+  static size_t roundUp(size_t capacity) {
+    size_t size = 1;
+    while(size < capacity) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  // double capacity, rearrange elements from index 0.
+  void grow() {
+    vector<T> items(_items.size() << 1);
+    for(size_t i = 0; i < _size; i++) {
+      items[i] = std::move(_items[(_head + i) & mask()]);
+    }
+    _items.swap(items);
+    _head = 0;
+  }
+
+  vector<T> _items;
+  size_t _head;
+  size_t _size;
+};
+
+}
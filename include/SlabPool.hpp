@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+#include "Utils.hpp"
+#include "VecBuffer.hpp"
+
+using namespace std;
+
+namespace netio {
+
+/**
+ * Pool of fixed size slabs for receiving.
+ *
+ * Slab is released to the cache of the thread which drops the last reference, the cache is
+ * bounded, slabs beyond it are freed. So the looper thread reuses its slabs without allocating
+ * or zero filling them again.
+ */
+class SlabPool {
+ public:
+  static const size_t SLAB_SIZE = SIZE_K(16);
+  // max slabs cached by each thread.
+  static const size_t CACHE_MAX = 64;
+
+  /**
+   * Take a slab from cache of current thread, allocate one if cache is empty.
+   */
+  static VecData* take();
+
+  /**
+   * Give the slab back to cache of current thread directly, when it's never shared.
+   */
+  static void giveBack(VecData* slab);
+
+  /**
+   * Wrap slab to shared vector data, it goes back to cache on last reference dropped.
+   */
+  static SpVecData wrap(VecData* slab) {
+    return SpVecData(slab, &SlabPool::giveBack);
+  }
+
+ private:
+  struct ThreadCache {
+    ThreadCache() : _slabs() { _slabs.reserve(CACHE_MAX); }
+    ~ThreadCache();
+    vector<VecData*> _slabs;
+  };
+
+  static thread_local ThreadCache _cache;
+};
+
+}
@@ -13,7 +13,10 @@ namespace netio {
 class TcpAcceptor {
   typedef function<void(int fd, const InetAddr&)> OnNewConnection;
  public:
-  TcpAcceptor(MultiplexLooper* looper, uint16_t port);
+  /**
+   * @param reusePort : bind with SO_REUSEPORT, for running one acceptor per looper on the same port.
+   */
+  TcpAcceptor(MultiplexLooper* looper, uint16_t port, bool reusePort = false);
   ~TcpAcceptor();
 
   void setNewConnCallback(const OnNewConnection& onNewConn) {
@@ -25,14 +28,33 @@ class TcpAcceptor {
   }
 #endif
   
+  /**
+   * Max connections accepted on one readable event.
+   */
+  void setAcceptBatch(size_t batch) {
+    _acceptBatch = (batch > 0) ? batch : 1;
+  }
+
+  MultiplexLooper* getLooper() const {
+    return _channel.getLooper();
+  }
+
   void handleRead();
   void attach();
   void detach();
  private:
+  // fd exhausted, drop one pending connection by the reserved fd, or it keep readable forever.
+  // return true if one connection dropped and reserved fd recovered.
+  bool dropPendingConnection();
+
   ServerSocket _sock;
   Channel _channel;
   // On new connection callback.
   OnNewConnection _onNewConn;
+  // accept at most this count of connections each readable event.
+  size_t _acceptBatch;
+  // reserved fd, give it up when we run out of fd.
+  int _idleFd;
 };
 
 
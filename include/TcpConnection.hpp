@@ -3,8 +3,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
-#include <mutex>
 #include <list>
+#include <deque>
 #include <thread>
 #include <errno.h>
 #include <string>
@@ -15,10 +15,17 @@
 #include "InetSock.hpp"
 #include "Utils.hpp"
 #include "VecBuffer.hpp"
+#include "BufferChain.hpp"
+#include "RingQueue.hpp"
+#include "FileRegion.hpp"
 
 
 namespace netio {
 
+// id of connection in TcpServer's registry, see ConnectionTable.
+typedef uint64_t ConnId;
+const ConnId INVALID_CONN_ID = 0;
+
 /**
  * Cause connction is real data read/write channel, we have codec for data to pack to structured.
  * template parameter @NP specify the netpack codec.
@@ -34,22 +41,55 @@ namespace netio {
 class TcpConnection : public enable_shared_from_this<TcpConnection> {
   typedef shared_ptr<TcpConnection> SpTcpConnection; 
   typedef function<void(SpTcpConnection, SpVecBuffer&)> OnNewMessage;
+  typedef function<void(SpTcpConnection, BufferChain&)> OnNewChain;
   typedef function<void(SpTcpConnection, int)> OnConnClose;
+  typedef function<void(SpTcpConnection, size_t)> OnHighWatermark;
+  typedef function<void(SpTcpConnection)> OnWriteDrained;
  public:
-  TcpConnection(MultiplexLooper* looper, int fd, const struct sockaddr_in& addr) :
-      _rcvBuf(new VecBuffer(_predMsgLen)),
+  /**
+   * @param nonblocked : fd is already in non blocking mode (e.g. accept4 with SOCK_NONBLOCK), skip fcntl.
+   */
+  TcpConnection(MultiplexLooper* looper, int fd, const struct sockaddr_in& addr, bool nonblocked = false) :
+      _sndQueue(SND_QUEUE_INIT),
+      _sndHeadOffset(0),
+      _sndBytes(0),
+      _sndHighMark(SND_HIGH_MARK),
+      _sndLowMark(SND_LOW_MARK),
+      _sndAboveHigh(false),
+      _pauseReadOnHigh(false),
+      _readPausedByHigh(false),
+      _deferFlush(false),
+      _flushScheduled(false),
+      _zcThreshold(0),
+      _zcNextSeq(0),
+      _zcPending(),
+      _rcvBuf(),
+      _rcvMin(RCV_BUF_MIN),
+      _rcvMax(RCV_BUF_MAX),
+      _rcvAvg(RCV_BUF_INIT),
+      _readBudget(READ_BUDGET),
+      _readScheduled(false),
+      _rcvChain(),
+      _rcvSlab(),
+      _rcvSlabUsed(0),
       _peerAddr(addr),
       _sock(fd),
-      _channel(looper, fd)
+      _channel(looper, fd),
+      _connId(INVALID_CONN_ID)
   {
     ASSERT(fd >= 0);
+    looper->incConnection();
+
     // set non blocking mode for TcpConnection
-    _sock.setNonblocking(true);
+    if(!nonblocked) {
+      _sock.setNonblocking(true);
+    }
 
     // setup events callback.
     _channel.setReadCallback(std::bind(&TcpConnection::handleRead, this));
     _channel.setWriteCallback(std::bind(&TcpConnection::handleWrite, this));
     _channel.setCloseHandler(std::bind(&TcpConnection::handleClose, this));
+    _channel.setErrorHandler(std::bind(&TcpConnection::handleError, this));
   
     // enable readble event by default.
     //    _channel.enableAll(true);
@@ -65,12 +105,17 @@ class TcpConnection : public enable_shared_from_this<TcpConnection> {
     ASSERT(!_channel.isAttached());
     LOGI("tc", "%s destroy", _strInfo);
     _sock.close();
+    _channel.getLooper()->decConnection();
   }
 
   int getFd() const {
     return _sock.getFd();
   }
 
+  // id in connection registry, INVALID_CONN_ID if not registered.
+  ConnId getConnId() const { return _connId; }
+  void setConnId(ConnId id) { _connId = id; }
+
   // callbacks for read/write error and close event from looper thread.
   void handleRead();
   
@@ -84,6 +129,9 @@ class TcpConnection : public enable_shared_from_this<TcpConnection> {
     }
   }
 
+  // EPOLLERR, zero copy completions or socket error.
+  void handleError();
+
   // attach and detach channel
   void attach() { _channel.attach(); }
   void detach() { _channel.detach(); }
@@ -91,33 +139,143 @@ class TcpConnection : public enable_shared_from_this<TcpConnection> {
   void setNewMessageHandler(const OnNewMessage& handler) { _newMessageHandler = handler; }
   void setNewMessageHandler(OnNewMessage&& handler) { _newMessageHandler = std::move(handler); }
 
+  /**
+   * Receive into pooled fixed size slabs instead of one contiguous buffer. Handler gets the chain
+   * of received slices, consumes what it can decode and leaves the rest for next time.
+   * If set, it takes place of new message handler.
+   */
+  void setNewChainHandler(const OnNewChain& handler) { _newChainHandler = handler; }
+  void setNewChainHandler(OnNewChain&& handler) { _newChainHandler = std::move(handler); }
+
+  /**
+   * Bounds of receive buffer size. Size of next receive buffer follows average size of recent reads,
+   * grows fast when a read fills the buffer up, shrinks slowly, always within [minSize, maxSize].
+   */
+  void setReceiveBufferBounds(size_t minSize, size_t maxSize) {
+    ASSERT(minSize > 0 && minSize <= maxSize);
+    _rcvMin = static_cast<uint32_t>(minSize);
+    _rcvMax = static_cast<uint32_t>(maxSize);
+  }
+
+  // size of buffer for next read.
+  size_t predictReceiveSize() const {
+    size_t size = _rcvMin;
+    while(size < _rcvAvg && size < _rcvMax) {
+      size <<= 1;
+    }
+    return std::min(size, static_cast<size_t>(_rcvMax));
+  }
+
+  /**
+   * Bytes read in one wakeup at most, 0 for no limit. Connection with more data goes on reading
+   * after other channels of the looper iteration are served, so one busy peer can't starve others.
+   */
+  void setReadBudget(size_t bytes) { _readBudget = bytes; }
+
   void setCloseHandler(const OnConnClose& handler) { _closedHandler = handler; }
   void setCloseHandler(OnConnClose&& handler) { _closedHandler = std::move(handler); }
 
+  /**
+   * Watermarks of bytes in send queue. When queued bytes reach high, high watermark handler is called,
+   * and reading is paused if pauseRead is set. When they drop to low again, reading is resumed and
+   * write drained handler is called. Handlers are called in looper thread.
+   */
+  void setWriteWatermarks(size_t high, size_t low) {
+    ASSERT(low < high);
+    _sndHighMark = high;
+    _sndLowMark = low;
+  }
+
+  void setPauseReadOnHighWatermark(bool pauseRead) { _pauseReadOnHigh = pauseRead; }
+
+  /**
+   * Deferred flush (cork) mode. Sends in one looper iteration are queued and flushed together
+   * by one writev at the end of the iteration, cut syscalls for pipelined protocols.
+   */
+  void setDeferredFlush(bool deferred) { _deferFlush = deferred; }
+
+  void setHighWatermarkHandler(const OnHighWatermark& handler) { _highWatermarkHandler = handler; }
+  void setHighWatermarkHandler(OnHighWatermark&& handler) { _highWatermarkHandler = std::move(handler); }
+
+  void setWriteDrainedHandler(const OnWriteDrained& handler) { _writeDrainedHandler = handler; }
+  void setWriteDrainedHandler(OnWriteDrained&& handler) { _writeDrainedHandler = std::move(handler); }
+
   // get remote address information
   InetAddr getPeerAddr() const { return _peerAddr; }
   uint32_t getPeerIp() const { return _peerAddr.ip(); }
   uint16_t getPeerPort() const { return _peerAddr.port(); }
 
+  /**
+   * Send buffers in order. Can be called from any thread, buffers are handed over to looper thread
+   * through its lock free runnable queue, send queue itself is only touched by looper thread.
+   */
   void sendMultiple(list<SpVecBuffer>& datas) {
-    auto runnable = [&, datas] () {
-      _sndBufList.splice(_sndBufList.end(), static_cast<list<SpVecBuffer> >(datas));
-      sendInternal();
-    };
-
-    _channel.getLooper()->postRunnable(runnable);
+    SpTcpConnection self = this->shared_from_this();
+    _channel.getLooper()->postRunnable([self, datas] () {
+        bool idle = self->_sndQueue.empty();
+        for(auto iter = datas.begin(); iter != datas.end(); iter++) {
+          self->enqueueSend(*iter);
+        }
+        // if queue was not empty, we are waiting for writtable already.
+        if(idle) {
+          self->flushOrDefer();
+        }
+      });
   }
   
+  /**
+   * Send slices of the chain in order with one writev, no copy.
+   */
+  void send(const BufferChain& chain) {
+    SpTcpConnection self = this->shared_from_this();
+    _channel.getLooper()->postRunnable([self, chain] () {
+        bool idle = self->_sndQueue.empty();
+        chain.forEachSlice([&self] (const SpVecBuffer& slice) {
+            self->enqueueSend(slice);
+          });
+        if(idle) {
+          self->flushOrDefer();
+        }
+      });
+  }
+
   void send(const SpVecBuffer& data) {
-    auto runnable = [&, data] () {
-      _sndBufList.push_back(data);
-      sendInternal();
-    };
+    SpTcpConnection self = this->shared_from_this();
+    _channel.getLooper()->postRunnable([self, data] () {
+        self->sendInLoop(data);
+      });
+  }
 
-    _channel.getLooper()->postRunnable(runnable);
+  /**
+   * Send file region by sendfile, in order with buffers sended before and after it.
+   */
+  void sendFile(const SpFileRegion& region) {
+    SpTcpConnection self = this->shared_from_this();
+    _channel.getLooper()->postRunnable([self, region] () {
+        bool idle = self->_sndQueue.empty();
+        self->enqueueSend(SendItem(region));
+        if(idle) {
+          self->flushOrDefer();
+        }
+      });
   }
-  
 
+  void sendFile(int fd, off_t offset, size_t len, bool autoClose = false) {
+    sendFile(SpFileRegion(new FileRegion(fd, offset, len, autoClose)));
+  }
+
+  /**
+   * Send buffers not less than threshold with MSG_ZEROCOPY, 0 to disable. Buffer is kept until kernel
+   * reports completion. Fall back to copy if kernel doesn't support it, or reports it copied anyway.
+   * Call it in looper thread.
+   */
+  void setZeroCopyThreshold(size_t threshold);
+
+  // bytes waiting in send queue, looper thread only.
+  size_t pendingSendBytes() const {
+    return _sndBytes;
+  }
+  
   const char* strInfo() const { 
     return _strInfo;
   }
@@ -131,54 +289,173 @@ class TcpConnection : public enable_shared_from_this<TcpConnection> {
   }
 
  private:
+  // element of send queue, either a buffer or a file region.
+  struct SendItem {
+    SendItem() : _buffer(), _file() {}
+    SendItem(const SpVecBuffer& buffer) : _buffer(buffer), _file() {}
+    explicit SendItem(const SpFileRegion& file) : _buffer(), _file(file) {}
+
+    size_t size() const {
+      if(nullptr != _buffer) {
+        return _buffer->readableSize();
+      }
+      return (nullptr != _file) ? _file->length() : 0;
+    }
+
+    bool isFile() const {
+      return nullptr != _file;
+    }
+
+    SpVecBuffer _buffer;
+    SpFileRegion _file;
+  };
+
+  // feed size of last read to the average, cap is the buffer size we read into.
+  void updateReceiveAverage(size_t readed, size_t cap) {
+    if(readed >= cap) {
+      // buffer is full, there may be more, grow fast.
+      _rcvAvg = static_cast<uint32_t>(std::min(static_cast<size_t>(_rcvMax), std::max(readed, static_cast<size_t>(_rcvAvg)) << 1));
+    } else {
+      // ewma, weight of new sample is 1/8
+      _rcvAvg = static_cast<uint32_t>(_rcvAvg - (_rcvAvg >> 3) + (readed >> 3));
+    }
+  }
+
+  // read into slabs for chain handler.
+  void handleReadChain();
+  // take readed bytes from budget, return false and schedule reading again if it is used up.
+  bool consumeReadBudget(size_t& budget, size_t readed);
+  // deal with readv returns eof or error.
+  void handleReadFailure(ssize_t readed);
+
+  // close connection and notify close handler.
+  void closeOnError(int err);
+
   // this function is called by looper when writtable event happened.
   void sendInternal();
 
-  // mark size of bytes sended, not thread safe.
-  void markSended(size_t size) { 
-    size_t sended = size;
-    auto itSpBuf = _sndBufList.begin();
-
-    while(itSpBuf != _sndBufList.end()) {
-      if(sended >= (*itSpBuf)->readableSize()) {
-        _sndBufList.erase(itSpBuf++);
-        sended -= (*itSpBuf)->readableSize();
-      } else {
-        (*itSpBuf)->markRead(sended);
-        sended = 0;
+  // send head file region of queue, return false if we should stop sending.
+  bool sendFileInternal();
+
+  // send head buffer of queue with MSG_ZEROCOPY, return false if we should stop sending.
+  bool sendZeroCopyInternal();
+
+  // buffers reach the threshold are sended alone by zero copy, never copied by write/writev.
+  bool zeroCopyEligible(size_t size) const {
+    return _zcThreshold > 0 && size >= _zcThreshold;
+  }
+
+  // deal with result of a send call, return false if we should stop sending.
+  bool handleSended(ssize_t sended, size_t expected);
+
+  // release buffers whose zero copy sending is completed.
+  void readZeroCopyCompletions();
+
+  // write directly if nothing is queued, only queue what is left.
+  void sendInLoop(const SpVecBuffer& data);
+
+  // flush send queue now, or at the end of looper iteration in deferred flush mode.
+  void flushOrDefer();
+
+  // queue item, offset is bytes of it already sended, only allowed when queue is empty.
+  void enqueueSend(const SendItem& item, size_t offset = 0) {
+    size_t size = item.size();
+    if(LIKELY(size > offset)) {
+      ASSERT(0 == offset || _sndQueue.empty());
+      _sndBytes += size - offset;
+      _sndHeadOffset = _sndQueue.empty() ? offset : _sndHeadOffset;
+      _sndQueue.push_back(item);
+
+      if(UNLIKELY(_sndBytes >= _sndHighMark && !_sndAboveHigh)) {
+        handleHighWatermark();
       }
+    }
+  }
+
+  // mark size of bytes sended, looper thread only. Queued buffers are not modified, they may be shared
+  // with other connections, we track sended bytes of the head buffer instead.
+  void markSended(size_t size) {
+    _sndBytes -= size;
 
-      if(0 == sended) {
+    while(size > 0) {
+      size_t len = _sndQueue.front().size() - _sndHeadOffset;
+      if(size < len) {
+        _sndHeadOffset += size;
         break;
       }
+      size -= len;
+      _sndHeadOffset = 0;
+      _sndQueue.pop_front();
     }
-  }
 
-  void sendInLoopThread() {
-    _channel.getLooper()->postRunnable(std::bind(&TcpConnection::sendInternal, this));
+    if(UNLIKELY(_sndAboveHigh && _sndBytes <= _sndLowMark)) {
+      handleWriteDrained();
+    }
   }
 
+  void handleHighWatermark();
+  void handleWriteDrained();
+
   void dummyNewMessageHandler(SpTcpConnection conn, SpVecBuffer& buffer) {
     LOGW("tc", "%s receive buffer size=%d, dummy", conn->strInfo());
   }
   
-  // send buffer
-  mutable mutex _sndMutex;
-  list<SpVecBuffer> _sndBufList;
-
-  // receive buffer
+  // send queue, owned by looper thread.
+  RingQueue<SendItem> _sndQueue;
+  size_t _sndHeadOffset;   // bytes of head item already sended.
+  size_t _sndBytes;
+  size_t _sndHighMark;
+  size_t _sndLowMark;
+  bool _sndAboveHigh;
+  bool _pauseReadOnHigh;
+  bool _readPausedByHigh;  // reading is disabled by high watermark, resumed when drained.
+  bool _deferFlush;
+  bool _flushScheduled;
+
+  // zero copy sending, buffer is held until kernel notify completion of its sequence.
+  // sequences in the queue are consecutive, completed ones are popped once all before them complete.
+  struct ZeroCopyPending {
+    uint32_t _seq;
+    bool _done;
+    SpVecBuffer _buffer;
+  };
+  size_t _zcThreshold;
+  uint32_t _zcNextSeq;
+  deque<ZeroCopyPending> _zcPending;
+
+  // receive buffer, only held while it has unconsumed data.
   SpVecBuffer _rcvBuf;
+  uint32_t _rcvMin;
+  uint32_t _rcvMax;
+  uint32_t _rcvAvg;    // average size of recent reads
+  size_t _readBudget;
+  bool _readScheduled;
+
+  // receive slices for chain handler, and the slab we are filling.
+  BufferChain _rcvChain;
+  SpVecData _rcvSlab;
+  size_t _rcvSlabUsed;
 
   // connection.
   InetAddr _peerAddr;
   StreamSocket _sock;
   Channel _channel;
+  ConnId _connId;
 
   // callbacks
   OnNewMessage _newMessageHandler;
+  OnNewChain _newChainHandler;
   OnConnClose _closedHandler; // The handler will be called after fd closed.
-
-  static const size_t _predMsgLen;
+  OnHighWatermark _highWatermarkHandler;
+  OnWriteDrained _writeDrainedHandler;
+
+  static const size_t SND_QUEUE_INIT = 4;
+  static const size_t SND_HIGH_MARK = SIZE_M(4);
+  static const size_t SND_LOW_MARK = SIZE_M(1);
+  static const uint32_t RCV_BUF_MIN = 256;
+  static const uint32_t RCV_BUF_MAX = SIZE_K(64);
+  static const uint32_t RCV_BUF_INIT = SIZE_K(1);
+  static const size_t READ_BUDGET = SIZE_K(256);
   
   // use this buffer if there is much buffer to read, reduce calling recv system call.
   static __thread int8_t _rcvPendingBuffer[SIZE_K(32)];
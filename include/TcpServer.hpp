@@ -3,10 +3,11 @@
 #include <stdint.h>
 #include <map>
 #include <memory>
-#include <set>
+#include <vector>
 
 #include "TcpConnection.hpp"
 #include "TcpAcceptor.hpp"
+#include "ConnectionTable.hpp"
 #include "LooperPool.hpp"
 
 using namespace std;
@@ -18,8 +19,20 @@ class TcpServer {
   typedef shared_ptr<LooperPool<MultiplexLooper> > SpLooperPool;
   typedef function<void(SpTcpConnection&)> NewConnectionHandler;
  public:
-  // port to listen
-  explicit TcpServer(uint16_t port, SpLooperPool loopPool);
+  /**
+   * @param port : port to listen
+   * @param loopPool : loopers for connections
+   * @param reusePort : if true, every looper of the pool owns an acceptor bound with SO_REUSEPORT and
+   *                    accepts locally, connection stays on the looper that accepted it. Otherwise one
+   *                    acceptor on main looper hands connections over to the pool.
+   *
+   * Connection is registered on its own looper, new connection handler is called on that looper too.
+   */
+  TcpServer(uint16_t port, SpLooperPool loopPool, bool reusePort = false);
+  /**
+   * Connection tables are torn down on their own loopers, destructor waits for them, so it must not be
+   * called in a looper of the pool.
+   */
   ~TcpServer();
 
   void startWork();
@@ -41,8 +54,31 @@ class TcpServer {
     }
   }
 
+  /**
+   * Remove connection from registry, runs inline when called on the connection's looper. Table drops
+   * its reference at the end of current loop iteration, the connection may be still dispatching events.
+   */
   void removeConnection(const SpTcpConnection& connection) {
-    _mainLooper->postRunnable(bind(&TcpServer::removeConnInLoop, this, connection));
+    connection->getLooper()->postRunnable(bind(&TcpServer::removeConnInLoop, this, connection));
+  }
+
+  /**
+   * Find connection by id, can be called from any thread.
+   */
+  SpTcpConnection getConnection(ConnId id) const {
+    uint8_t shard = ConnectionTable::shardOf(id);
+    if(UNLIKELY(shard >= _connTables.size())) {
+      return nullptr;
+    }
+    return _connTables[shard]->lookup(id);
+  }
+
+  size_t connectionCount() const {
+    size_t count = 0;
+    for(size_t i = 0; i < _connTables.size(); i++) {
+      count += _connTables[i]->size();
+    }
+    return count;
   }
 
  private:
@@ -55,13 +91,23 @@ class TcpServer {
   void dummyResetConnectionHandler(const SpTcpConnection& conn, int cause) {
     LOGW("ts", "%s close connection, dummy", conn->strInfo());    
   }
-  // connection handler for TcpAcceptor
-  void onNewConnection(int fd, const InetAddr& addr);
+  // connection handler for TcpAcceptor, looper is nullptr if connection should pick one from pool.
+  void onNewConnection(MultiplexLooper* looper, int fd, const InetAddr& addr);
+  // run task(shard) on every looper at the end of its iteration, wait until all are done and
+  // tasks of the iteration queued after it finished.
+  void runOnLoopers(const function<void(size_t)>& task);
+  // register connection and notify client code, in connection's looper.
+  void addConnInLoop(size_t shard, SpTcpConnection& conn);
   // remove connection in looper
   void removeConnInLoop(SpTcpConnection& conn) {
     conn->detach();
-    int n = _connSet.erase(conn);
-    if(UNLIKELY(n != 1)) {
+    conn->getLooper()->runAfterIteration(bind(&TcpServer::unregisterConn, this, conn));
+  }
+  // drop table's reference after events of the iteration are dispatched.
+  void unregisterConn(SpTcpConnection& conn) {
+    ConnId id = conn->getConnId();
+    uint8_t shard = ConnectionTable::shardOf(id);
+    if(UNLIKELY(shard >= _connTables.size() || !_connTables[shard]->remove(id))) {
       COGW("%s remove connection failed, conn=%s", __func__, conn->strInfo());
     }
   }
@@ -72,10 +118,11 @@ class TcpServer {
   SpLooperPool _loopPool;
   // manage looper
   MultiplexLooper* _mainLooper;
-  // acceptor
-  TcpAcceptor _acceptor;
-  // TcpServer just hold TcpConnection, not for indexing.
-  set<SpTcpConnection> _connSet;
+  // accept on main looper only, or one acceptor each looper in reuse port mode.
+  bool _reusePort;
+  vector<SpTcpAcceptor> _acceptors;
+  // connection registry, one table for each looper of the pool, indexed by looper index.
+  vector<ConnectionTable*> _connTables;
   // callbacks for client code
   NewConnectionHandler _newConnHandler;
 };
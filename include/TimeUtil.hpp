@@ -19,6 +19,9 @@ class TimeUtil {
   /* get timestamp for gm */
   static uint32_t timestampSec();
   static uint64_t timestampMS();
+
+  /* monotonic clock in microseconds, for measuring intervals */
+  static uint64_t monotonicUs();
 };
 
 }
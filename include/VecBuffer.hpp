@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <list>
@@ -9,6 +10,7 @@
 
 #include "Utils.hpp"
 #include "Endian.hpp"
+#include "BufferPool.hpp"
 
 using namespace std;
 
@@ -25,13 +27,21 @@ namespace netio {
 
 class VecBuffer;
 typedef char CharType;
-typedef vector<CharType> VecData;
+// storage comes from thread caching pool, and is not zero filled.
+typedef vector<CharType, PoolAllocator<CharType> > VecData;
 typedef shared_ptr<VecData> SpVecData;
 typedef shared_ptr<VecBuffer> SpVecBuffer;
 
+// result of reading varint.
+typedef enum {
+  VARINT_OK = 0,
+  VARINT_NEED_MORE,     // not complete yet, wait for more bytes
+  VARINT_MALFORMED      // longer than 10 bytes or overflow 64 bits
+} VarintStatus;
+
 /**
  * Implements base on shared_ptr reference of vector.
- * and now we use default allocator for vector buffer.
+ * vector data and its reference count are allocated from BufferPool.
  *
  * We use smart pointer to manage memory, when VedData is not referenced, it will release automatically, 
  *
@@ -47,18 +57,18 @@ class VecBuffer {
   explicit VecBuffer(size_t size) :
       _offset(0),
       _len(0),
-      _buffer(new VecData(size))
+      _buffer(allocate_shared<VecData>(PoolAllocator<VecData>(), size))
   {}
 
   /**
    * For sending buffer construct and avoid to alloc pack header each time, we can call this function to get buffer that
    * has prepend for pack header before sending data generation.
    */
-  // explicit VecBuffer(size_t size, size_t prepend) :
-  //     _offset(prepend),
-  //     _len(0),
-  //     _buffer(new VecData(size + prepend))
-  // {}
+  VecBuffer(size_t size, size_t prepend) :
+      _offset(prepend),
+      _len(0),
+      _buffer(allocate_shared<VecData>(PoolAllocator<VecData>(), size + prepend))
+  {}
 
   /**
    * For sending buffer construct, we get continuous buffer from client clode most of time.
@@ -92,6 +102,42 @@ class VecBuffer {
     _offset = 0;
   }
 
+  /**
+   * Free space in front of readable data, can be filled by prepend.
+   */
+  size_t headroomSize() const {
+    return _offset;
+  }
+
+  /**
+   * Take size bytes of headroom into readable data, return pointer to them for writing header in place.
+   *
+   * NOTE : headroom of a buffer splited from the front is the splited data, prepend only to buffer
+   * created with headroom or by reserveHeadroom.
+   */
+  CharType* prepend(size_t size) {
+    ASSERT(size <= headroomSize());
+    _offset -= size;
+    _len += size;
+    return readablePtr();
+  }
+
+  /**
+   * Reserve headroom before anything is written, writtable size is not reduced, buffer is enlarged if there
+   * is not enough space. Storage shared with splited buffers is never touched, new one is allocated.
+   */
+  void reserveHeadroom(size_t size) {
+    ASSERT(0 == _len);
+    size_t total = size + writtableSize();
+
+    if(!_buffer.unique()) {
+      _buffer = allocate_shared<VecData>(PoolAllocator<VecData>(), total);
+    } else if(total > _buffer->size()) {
+      _buffer->resize(total);
+    }
+    _offset = size;
+  }
+
   CharType* writtablePtr() {
     CharType* bufptr = &*_buffer->begin();
     return bufptr + _offset + _len;
@@ -136,7 +182,7 @@ class VecBuffer {
    * Append writtable size with size;
    */
   void enlarge(size_t size) {
-    _buffer->resize(_buffer->size() + size);
+    resize(_buffer->size() + size);
   }
 
   /**
@@ -144,7 +190,7 @@ class VecBuffer {
    */
   void ensure(size_t size) {
     if(UNLIKELY((size + _offset) > _buffer->size())) {
-      _buffer->resize(size + _offset);
+      resize(size + _offset);
     }
   }
 
@@ -186,6 +232,143 @@ class VecBuffer {
     return result;
   }
 
+  /**
+   * Typed access. Value is read/written in big endian (network order) or little endian,
+   * T is 1/2/4/8 bytes integer type, byte order conversion is resolved at compile time.
+   */
+  template <typename T>
+  T peekBE() const {
+    ASSERT(readableSize() >= sizeof(T));
+    T x;
+    ::memcpy(&x, readablePtr(), sizeof(T));
+    return Endian::fromBig(x);
+  }
+
+  template <typename T>
+  T peekLE() const {
+    ASSERT(readableSize() >= sizeof(T));
+    T x;
+    ::memcpy(&x, readablePtr(), sizeof(T));
+    return Endian::fromLittle(x);
+  }
+
+  template <typename T>
+  T readBE() {
+    T x = peekBE<T>();
+    markRead(sizeof(T));
+    return x;
+  }
+
+  template <typename T>
+  T readLE() {
+    T x = peekLE<T>();
+    markRead(sizeof(T));
+    return x;
+  }
+
+  template <typename T>
+  void writeBE(T x) {
+    ASSERT(writtableSize() >= sizeof(T));
+    x = Endian::toBig(x);
+    ::memcpy(writtablePtr(), &x, sizeof(T));
+    markWrite(sizeof(T));
+  }
+
+  template <typename T>
+  void writeLE(T x) {
+    ASSERT(writtableSize() >= sizeof(T));
+    x = Endian::toLittle(x);
+    ::memcpy(writtablePtr(), &x, sizeof(T));
+    markWrite(sizeof(T));
+  }
+
+  int64_t peekInt64() const { return peekBE<int64_t>(); }
+  int64_t readInt64() { return readBE<int64_t>(); }
+
+  void writeInt8(int8_t x) { writeBE(x); }
+  void writeInt16(int16_t x) { writeBE(x); }
+  void writeInt32(int32_t x) { writeBE(x); }
+  void writeInt64(int64_t x) { writeBE(x); }
+
+  /**
+   * Write/read array of T, byte order of elements is converted in batch.
+   */
+  template <typename T>
+  void writeArrayBE(const T* data, size_t count) {
+    size_t bytes = sizeof(T) * count;
+    writeBytes(data, bytes);
+    if(Endian::HOST_LITTLE) {
+      Endian::swapArray(writtablePtr() - bytes, sizeof(T), count);
+    }
+  }
+
+  template <typename T>
+  void readArrayBE(T* data, size_t count) {
+    readBytes(data, sizeof(T) * count);
+    if(Endian::HOST_LITTLE) {
+      Endian::swapArray(data, sizeof(T), count);
+    }
+  }
+
+  void writeBytes(const void* data, size_t size) {
+    ASSERT(writtableSize() >= size);
+    ::memcpy(writtablePtr(), data, size);
+    markWrite(size);
+  }
+
+  void readBytes(void* data, size_t size) {
+    ASSERT(readableSize() >= size);
+    ::memcpy(data, readablePtr(), size);
+    markRead(size);
+  }
+
+  /**
+   * Unsigned LEB128 varint, 10 bytes at most for 64 bits.
+   */
+  void writeVarint(uint64_t x) {
+    ASSERT(writtableSize() >= varintSize(x));
+    uint8_t* ptr = reinterpret_cast<uint8_t*>(writtablePtr());
+    size_t n = 0;
+    while(x >= 0x80) {
+      ptr[n++] = static_cast<uint8_t>(x | 0x80);
+      x >>= 7;
+    }
+    ptr[n++] = static_cast<uint8_t>(x);
+    markWrite(n);
+  }
+
+  /**
+   * @return : VARINT_OK if x is read, otherwise nothing is consumed.
+   */
+  VarintStatus readVarint(uint64_t& x) {
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(readablePtr());
+    size_t limit = std::min(readableSize(), static_cast<size_t>(10));
+    uint64_t result = 0;
+
+    for(size_t i = 0; i < limit; i++) {
+      result |= static_cast<uint64_t>(ptr[i] & 0x7F) << (7 * i);
+      if(0 == (ptr[i] & 0x80)) {
+        // 10th byte carries the highest bit only.
+        if(UNLIKELY(9 == i && ptr[i] > 1)) {
+          return VARINT_MALFORMED;
+        }
+        x = result;
+        markRead(i + 1);
+        return VARINT_OK;
+      }
+    }
+    return (limit < 10) ? VARINT_NEED_MORE : VARINT_MALFORMED;
+  }
+
+  static size_t varintSize(uint64_t x) {
+    size_t n = 1;
+    while(x >= 0x80) {
+      x >>= 7;
+      n++;
+    }
+    return n;
+  }
+
   /**
    * Split buffer.
    *
@@ -200,8 +383,28 @@ class VecBuffer {
     }
     return nullptr;
   }
+
+  /**
+   * New buffer over readable data of this one, storage is shared, no copy. Marks on either buffer
+   * don't affect the other.
+   */
+  SpVecBuffer share() const {
+    return SpVecBuffer(new VecBuffer(_buffer, _offset, _len));
+  }
   
  private:
+  // storage shared with splited buffers may be read by others, never resize it in place, readable data
+  // is copied to new storage instead.
+  void resize(size_t size) {
+    if(_buffer.unique()) {
+      _buffer->resize(size);
+    } else {
+      SpVecData buffer = allocate_shared<VecData>(PoolAllocator<VecData>(), size);
+      ::memcpy(&*buffer->begin() + _offset, readablePtr(), _len);
+      _buffer.swap(buffer);
+    }
+  }
+
   off_t _offset;
   size_t _len;
   SpVecData _buffer;
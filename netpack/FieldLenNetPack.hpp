@@ -4,6 +4,7 @@
 
 #include "Dispatcher.hpp"
 #include "Endian.hpp"
+#include "BufferChain.hpp"
 
 namespace netio {
 
@@ -68,7 +69,22 @@ struct FLNPHeader {
    */
   static ssize_t peekPacketLength(const SpVecBuffer& buffer) {
     if(buffer->readableSize() >= sizeof(_len)) {
-      return static_cast<size_t>(buffer->peekInt16());      
+      return static_cast<uint16_t>(buffer->peekInt16());
+    }
+    return -1;
+  }
+
+  /** 
+   * peek packet length, include header, from buffer chain, length field may straddle slices.
+   * 
+   * @param chain 
+   * 
+   * @return 
+   */
+  static ssize_t peekPacketLength(const BufferChain& chain) {
+    uint16_t len;
+    if(chain.peek(&len, sizeof(len))) {
+      return Endian::ntoh16(len);
     }
     return -1;
   }
@@ -133,7 +149,7 @@ struct FLNPHeader {
 
 
   static void decode(SpVecBuffer& buffer, SpPeerMessage& pm) {
-    ASSERT(buffer->readableSize() > sizeof(struct FLNPHeader));
+    ASSERT(buffer->readableSize() >= sizeof(struct FLNPHeader));
 
     const struct FLNPHeader* header = static_cast<const struct FLNPHeader*>((void*)buffer->readablePtr());
     buffer->markRead(sizeof(struct FLNPHeader));
@@ -172,16 +188,36 @@ class FLNPack {
     return FLNPHeader::peekPacketLength(buffer);
   }
   
+  /** 
+   * packet length shorter than header can never be read, the stream is broken.
+   * 
+   * @param packSize : result of peekPackLength
+   * 
+   * @return 
+   */
+  static bool isMalformed(ssize_t packSize) {
+    return packSize >= 0 && packSize < static_cast<ssize_t>(sizeof(struct FLNPHeader));
+  }
+
   /** 
    * create peer message from vecbuffer.
    * 
    * @param buffer 
+   * @param malformed : set true if packet header is broken, nothing is consumed, caller should close
+   *                    the connection.
    * 
-   * @return 
+   * @return : nullptr if packet is not complete or malformed.
    */
-  static SpPeerMessage readMessage(SpVecBuffer& buffer) {
+  static SpPeerMessage readMessage(SpVecBuffer& buffer, bool* malformed = nullptr) {
     ssize_t packSize = FLNPHeader::peekPacketLength(buffer);
 
+    if(UNLIKELY(isMalformed(packSize))) {
+      if(nullptr != malformed) {
+        *malformed = true;
+      }
+      return nullptr;
+    }
+
     if(LIKELY(packSize > 0)) {
       SpVecBuffer splited = buffer->split(static_cast<size_t>(packSize));
       if(nullptr != splited) {
@@ -194,6 +230,36 @@ class FLNPack {
     return nullptr;
   }
 
+  /** 
+   * create peer message from buffer chain. packet inside one slice is taken without copy.
+   * 
+   * @param chain 
+   * @param malformed : set true if packet header is broken, see readMessage of vecbuffer.
+   * 
+   * @return : nullptr if packet is not complete or malformed.
+   */
+  static SpPeerMessage readMessage(BufferChain& chain, bool* malformed = nullptr) {
+    ssize_t packSize = FLNPHeader::peekPacketLength(chain);
+
+    if(UNLIKELY(isMalformed(packSize))) {
+      if(nullptr != malformed) {
+        *malformed = true;
+      }
+      return nullptr;
+    }
+
+    if(LIKELY(packSize > 0)) {
+      SpVecBuffer splited = chain.split(static_cast<size_t>(packSize));
+      if(nullptr != splited) {
+        SpPeerMessage spMsg(new PeerMessage);
+        FLNPHeader::decode(splited, spMsg);
+        return spMsg;
+      }
+    }
+
+    return nullptr;
+  }
+
   /** 
    * Create netpack buffer. the buffer has no encoded header.
    * 
@@ -205,6 +271,53 @@ class FLNPack {
     return SpVecBuffer(new VecBuffer(sizeof(struct FLNPHeader) + conlen));
   }
 
+  /** 
+   * Create content buffer with headroom for netpack header. Write content first, then call writeHeader
+   * to put header in front of it, no content copy.
+   * 
+   * @param conlen 
+   * 
+   * @return 
+   */
+  static SpVecBuffer createContentBuffer(size_t conlen) {
+    return SpVecBuffer(new VecBuffer(conlen, sizeof(struct FLNPHeader)));
+  }
+
+  /** 
+   * Write netpack header in the headroom of content buffer. If there is not enough headroom,
+   * fallback to copy content to a new netpack buffer.
+   * 
+   * @param proto 
+   * @param version 
+   * @param seq 
+   * @param cmd 
+   * @param content 
+   * 
+   * @return : netpack buffer, the content buffer itself if header is written in place.
+   */
+  static SpVecBuffer writeHeader(uint8_t proto, uint8_t version, uint16_t seq, uint32_t cmd, SpVecBuffer& content) {
+    size_t conlen = content->readableSize();
+
+    if(LIKELY(content->headroomSize() >= sizeof(struct FLNPHeader))) {
+      CharType* header = content->prepend(sizeof(struct FLNPHeader));
+      FLNPHeader::encode(conlen, proto, version, seq, cmd, header, sizeof(struct FLNPHeader));
+      return content;
+    }
+
+    return writeMessage(proto, version, seq, cmd, content->readablePtr(), conlen);
+  }
+
+  /** 
+   * Write header of peer message in the headroom of its buffer, see writeHeader.
+   * 
+   * @param peerMsg 
+   * 
+   * @return 
+   */
+  static SpVecBuffer writeHeader(struct PeerMessage& peerMsg) {
+    return writeHeader(static_cast<uint8_t>(peerMsg._proto), peerMsg._version, peerMsg._seq, peerMsg._cmd, peerMsg._buffer);
+  }
+
   /** 
    * Create netpack buffer and write netpack header information. After buffer created, we get writtable ptr and
    * write buffer to perform zero copy pack operation.
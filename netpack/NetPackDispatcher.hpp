@@ -37,13 +37,19 @@ class NetPackDispatcher : public Dispatcher<typename NPIMPL::MsgType, SrcType> {
    * 
    * @param buffer : message parse from
    * @param source : buffer owner.
+   * 
+   * @return : false if malformed packet is found, source should be closed.
    */
-  void dispatch(SpVecBuffer& buffer, SrcType& source) {
+  bool dispatch(SpVecBuffer& buffer, SrcType& source) {
     while(true) {
-      SpMsgType message  = NPIMPL::readMessage(buffer);
+      bool malformed = false;
+      SpMsgType message  = NPIMPL::readMessage(buffer, &malformed);
 
       if(nullptr != message) {
         Dispatcher<typename NPIMPL::MsgType, SrcType>::dispatch(message->getCmd(), message, source);
+      } else if(UNLIKELY(malformed)) {
+        LOGW("npd", "malformed packet, length=%zd", NPIMPL::peekPackLength(buffer));
+        return false;
       } else {
         // ensure buffer size to store following message.
         ssize_t expect = NPIMPL::peekPackLength(buffer);
@@ -55,6 +61,7 @@ class NetPackDispatcher : public Dispatcher<typename NPIMPL::MsgType, SrcType> {
         break;
       }
     }
+    return true;
   }
 };
 
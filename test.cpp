@@ -2,7 +2,12 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <stdint.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 #include "InetAddr.hpp"
 #include "SingleCache.hpp"
 #include "Logger.hpp"
@@ -20,6 +25,15 @@
 #include "LooperPool.hpp"
 #include "TcpServer.hpp"
 #include "TcpConnector.hpp"
+#include "ConnectionTable.hpp"
+#include "MpscQueue.hpp"
+#include "RingQueue.hpp"
+#include "BufferPool.hpp"
+#include "BufferChain.hpp"
+#include "Endian.hpp"
+#include "BitmapTree.hpp"
+#include "FixedBuffer.hpp"
+#include "TimeUtil.hpp"
 
 #include "FieldLenNetPack.hpp"
 
@@ -92,6 +106,27 @@ void test_looperPool() {
   loopers.getLooper();
 }
 
+void test_looperPoolSelect() {
+  // looper without load metrics falls back to round robin.
+  static_assert(!LooperLoadTraits<MessageLooper>::value, "MessageLooper has no load metrics");
+  static_assert(LooperLoadTraits<MultiplexLooper>::value, "MultiplexLooper has load metrics");
+
+  LooperPool<MessageLooper> msgLoopers(2);
+  msgLoopers.setSelectStrategy(SELECT_LEAST_CONNECTIONS);
+  MessageLooper* first = msgLoopers.getLooper();
+  MessageLooper* second = msgLoopers.getLooper();
+  ASSERT(first != second && first == msgLoopers.getLooper());
+
+  LooperPool<MultiplexLooper> loopers(3);
+  loopers.setSelectStrategy(SELECT_LEAST_CONNECTIONS);
+  loopers.getLooperAt(0)->incConnection();
+  loopers.getLooperAt(1)->incConnection();
+  ASSERT(loopers.getLooperAt(2) == loopers.getLooper());
+  loopers.getLooperAt(0)->decConnection();
+  loopers.getLooperAt(1)->decConnection();
+  std::cout << "looper pool select ok" << std::endl;
+}
+
 class MyHandler : public LoopHandler {
   void handleMessage(LoopMessage& message) {
     COGI("message with %d %p %p", message.what(), message.lparam(), message.rparam());
@@ -137,7 +172,7 @@ void on_message(SpTcpConnection conn, SpVecBuffer buf) {
   conn->send(buffer);
 }
 
-void server_on_new_conn(int hash, SpTcpConnection conn) {
+void server_on_new_conn(SpTcpConnection& conn) {
   COGFUNC();
   conn->attach();
 
@@ -149,10 +184,10 @@ void server_on_new_conn(int hash, SpTcpConnection conn) {
 
 
 void test_tcpserver() {
-  SpLooperPool loopPool(new LooperPool<MultiplexLooper>(5));
+  shared_ptr<LooperPool<MultiplexLooper> > loopPool(new LooperPool<MultiplexLooper>(5));
   static TcpServer server(3001, loopPool);
 
-  server.setNewConnectionHandler(server_on_new_conn);
+  server.setConnectionHandler(server_on_new_conn);
   
   server.startWork();
   sleep(3000);
@@ -192,6 +227,664 @@ void test_tcpclient() {
   sleep(3000);
 }
 
+void test_connectionTable() {
+  MultiplexLooper looper;
+  ConnectionTable table(1);
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  SpTcpConnection conn(new TcpConnection(&looper, fds[0], InetAddr(0).getSockAddr(), true));
+
+  ConnId id = table.insert(conn);
+  ASSERT(table.lookup(id) == conn);
+  std::cout << "insert id=" << id << ", found=" << (table.lookup(id) == conn) << std::endl;
+
+  // stale or forged id must not be found, slot out of the table must not be touched.
+  ConnId forged[] = {
+    id + 1,                                        // slot never used
+    (id & ~0xFFFFFFFFULL) | 0xFFFFFFFFULL,         // slot out of the table
+    (id & ~0xFFFFFFFFULL) | (1024 * 4096),         // first slot out of the table
+    (static_cast<ConnId>(2) << 56) | (id & 0xFFFFFFFFFFFFFFULL),  // other shard
+    (static_cast<ConnId>(0xFF) << 56) | 0xFFFFFFFFULL,
+  };
+  for(size_t i = 0; i < sizeof(forged) / sizeof(forged[0]); i++) {
+    ASSERT(nullptr == table.lookup(forged[i]));
+    std::cout << "forged id=" << forged[i] << ", found=" << (nullptr != table.lookup(forged[i])) << std::endl;
+  }
+
+  table.remove(id);
+  ASSERT(nullptr == table.lookup(id) && 0 == table.size());
+  std::cout << "removed id=" << id << ", found=" << (nullptr != table.lookup(id)) << ", size=" << table.size() << std::endl;
+  close(fds[1]);
+}
+
+void test_flnpackMalformed() {
+  // length field shorter than header : zero, short, and empty content which is valid.
+  uint16_t lens[] = {0, 5, sizeof(struct FLNPHeader)};
+
+  for(size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+    SpVecBuffer buffer(new VecBuffer(32));
+    FLNPHeader::encode(0, FLNPProto_JSON, 1, 1, 100, buffer);
+    *reinterpret_cast<uint16_t*>(buffer->readablePtr()) = Endian::hton16(lens[i]);
+
+    BufferChain chain;
+    SpVecBuffer copy(new VecBuffer(32));
+    ::memcpy(copy->writtablePtr(), buffer->readablePtr(), buffer->readableSize());
+    copy->markWrite(buffer->readableSize());
+    chain.append(copy);
+
+    bool malformed = false;
+    SpPeerMessage msg = FLNPack::readMessage(buffer, &malformed);
+    ASSERT(malformed == FLNPack::isMalformed(lens[i]) && (nullptr != msg) == !malformed);
+    std::cout << "vecbuffer len=" << lens[i] << ", message=" << (nullptr != msg)
+              << ", malformed=" << malformed << ", left=" << buffer->readableSize() << std::endl;
+
+    malformed = false;
+    msg = FLNPack::readMessage(chain, &malformed);
+    ASSERT(malformed == FLNPack::isMalformed(lens[i]) && (nullptr != msg) == !malformed);
+    std::cout << "chain len=" << lens[i] << ", message=" << (nullptr != msg)
+              << ", malformed=" << malformed << ", left=" << chain.readableSize() << std::endl;
+  }
+}
+
+struct TestNode : public MpscNode {
+  int _producer;
+  int _seq;
+};
+
+void test_mpscQueue() {
+  const int producers = 4;
+  const int count = 100000;
+  MpscQueue<TestNode> queue;
+  vector<TestNode> nodes(producers * count);
+
+  ASSERT(queue.empty() && nullptr == queue.pop());
+
+  vector<thread> threads;
+  for(int p = 0; p < producers; p++) {
+    threads.push_back(thread([&queue, &nodes, p, count] () {
+          for(int i = 0; i < count; i++) {
+            TestNode& node = nodes[p * count + i];
+            node._producer = p;
+            node._seq = i;
+            queue.push(&node);
+          }
+        }));
+  }
+
+  // order of each producer is kept.
+  vector<int> next(producers, 0);
+  int popped = 0;
+  while(popped < producers * count) {
+    TestNode* node = queue.pop();
+    if(nullptr == node) {
+      continue;
+    }
+    ASSERT(node->_seq == next[node->_producer]);
+    next[node->_producer]++;
+    popped++;
+  }
+
+  for(size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  ASSERT(queue.empty() && nullptr == queue.pop());
+  std::cout << "mpsc queue popped=" << popped << ", ok" << std::endl;
+}
+
+void bench_mpscQueue() {
+  const int producers = 4;
+  const int count = 1000000;
+  vector<TestNode> nodes(producers * count);
+  MpscQueue<TestNode> queue;
+  mutex lock;
+  deque<TestNode*> locked;
+
+  for(int round = 0; round < 2; round++) {
+    uint64_t start = TimeUtil::monotonicUs();
+    vector<thread> threads;
+    for(int p = 0; p < producers; p++) {
+      threads.push_back(thread([&, p] () {
+            for(int i = 0; i < count; i++) {
+              if(0 == round) {
+                queue.push(&nodes[p * count + i]);
+              } else {
+                lock_guard<mutex> guard(lock);
+                locked.push_back(&nodes[p * count + i]);
+              }
+            }
+          }));
+    }
+
+    int popped = 0;
+    while(popped < producers * count) {
+      if(0 == round) {
+        popped += (nullptr != queue.pop()) ? 1 : 0;
+      } else {
+        lock_guard<mutex> guard(lock);
+        if(!locked.empty()) {
+          locked.pop_front();
+          popped++;
+        }
+      }
+    }
+
+    for(size_t i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+    uint64_t cost = TimeUtil::monotonicUs() - start;
+    printf("bench %-24s %d producers, %.1f ns/op\n", (0 == round) ? "MpscQueue" : "mutex+deque", producers,
+           cost * 1000.0 / popped);
+  }
+}
+
+void test_vecBufferShared() {
+  SpVecBuffer buffer(new VecBuffer(16));
+  ::memcpy(buffer->writtablePtr(), "0123456789abcdef", 16);
+  buffer->markWrite(16);
+
+  SpVecBuffer head = buffer->split(10);
+  const CharType* headPtr = head->readablePtr();
+
+  // storage shared with head must not be resized in place.
+  buffer->ensure(4096);
+  ASSERT(head->readablePtr() == headPtr && 0 == ::memcmp(headPtr, "0123456789", 10));
+  ASSERT(buffer->writtableSize() >= 4096 - 6 && 0 == ::memcmp(buffer->readablePtr(), "abcdef", 6));
+  ASSERT(buffer->readablePtr() != headPtr + 10);
+
+  // not shared any more, resized in place.
+  head.reset();
+  buffer->enlarge(100);
+  ASSERT(0 == ::memcmp(buffer->readablePtr(), "abcdef", 6));
+  std::cout << "vecbuffer shared storage ok" << std::endl;
+}
+
+void bench_flnpackRead() {
+  const int count = 200000;
+  const size_t slice = 16 * 1024;
+  char payload[512];
+  ::memset(payload, 'a', sizeof(payload));
+
+  // stream of messages with content 1~512 bytes.
+  string stream;
+  for(int i = 0; i < count; i++) {
+    SpVecBuffer msg = FLNPack::writeMessage(FLNPProto_JSON, 1, i, i, payload, 1 + (i * 37) % sizeof(payload));
+    stream.append(msg->readablePtr(), msg->readableSize());
+  }
+
+  // one contiguous buffer.
+  uint64_t start = TimeUtil::monotonicUs();
+  SpVecBuffer buffer(new VecBuffer(stream.size()));
+  ::memcpy(buffer->writtablePtr(), stream.data(), stream.size());
+  buffer->markWrite(stream.size());
+  int readed = 0;
+  while(nullptr != FLNPack::readMessage(buffer)) {
+    readed++;
+  }
+  uint64_t cost = TimeUtil::monotonicUs() - start;
+  ASSERT(count == readed);
+  printf("bench %-24s %d messages, %.1f ns/msg\n", "FLNPack vecbuffer", readed, cost * 1000.0 / readed);
+
+  // slab sized slices like chain receiving, message straddles slices is gathered.
+  start = TimeUtil::monotonicUs();
+  BufferChain chain;
+  readed = 0;
+  for(size_t off = 0; off < stream.size(); off += slice) {
+    size_t len = std::min(slice, stream.size() - off);
+    SpVecBuffer part(new VecBuffer(len));
+    ::memcpy(part->writtablePtr(), stream.data() + off, len);
+    part->markWrite(len);
+    chain.append(std::move(part));
+    while(nullptr != FLNPack::readMessage(chain)) {
+      readed++;
+    }
+  }
+  cost = TimeUtil::monotonicUs() - start;
+  ASSERT(count == readed);
+  printf("bench %-24s %d messages, %.1f ns/msg\n", "FLNPack chain", readed, cost * 1000.0 / readed);
+}
+
+static SpVecBuffer bufferOf(const char* str) {
+  SpVecBuffer buffer(new VecBuffer(::strlen(str)));
+  buffer->writeBytes(str, ::strlen(str));
+  return buffer;
+}
+
+static bool chainEquals(const BufferChain& chain, const char* str) {
+  char data[64];
+  size_t len = ::strlen(str);
+  return chain.readableSize() == len && chain.peek(data, len) && 0 == ::memcmp(data, str, len);
+}
+
+void test_bufferChainCow() {
+  // chain keeps its own view, marks on the source don't leak in.
+  SpVecBuffer source = bufferOf("helloworld");
+  BufferChain chain;
+  chain.append(source);
+  source->markRead(5);
+  ASSERT(chainEquals(chain, "helloworld"));
+
+  // copied chains share slices, marks on one don't leak into the other.
+  BufferChain copy(chain);
+  copy.markRead(3);
+  SpVecBuffer hello = chain.split(5);
+  ASSERT(5 == hello->readableSize() && 0 == ::memcmp(hello->readablePtr(), "hello", 5));
+  ASSERT(chainEquals(chain, "world") && chainEquals(copy, "loworld"));
+  ASSERT(5 == source->readableSize());
+
+  // self append doubles the content.
+  copy.append(copy);
+  ASSERT(chainEquals(copy, "loworldloworld"));
+
+  // continued slices of one storage merge, the appended source is untouched.
+  SpVecBuffer whole = bufferOf("abcdef");
+  SpVecBuffer abc = whole->split(3);
+  BufferChain merged;
+  merged.append(abc);
+  merged.append(whole);
+  ASSERT(1 == merged.sliceCount() && chainEquals(merged, "abcdef"));
+  ASSERT(3 == abc->readableSize() && 3 == whole->readableSize());
+
+  // gathering straddled bytes doesn't modify the slices.
+  SpVecBuffer ab = bufferOf("ab");
+  SpVecBuffer cd = bufferOf("cd");
+  BufferChain straddled;
+  straddled.append(ab);
+  straddled.append(cd);
+  const CharType* ptr = straddled.peekContiguous(3);
+  ASSERT(nullptr != ptr && 0 == ::memcmp(ptr, "abc", 3));
+  ASSERT(chainEquals(straddled, "abcd") && 2 == ab->readableSize() && 2 == cd->readableSize());
+  std::cout << "buffer chain copy on write ok" << std::endl;
+}
+
+void test_ringQueue() {
+  RingQueue<int> queue(3);
+  ASSERT(4 == queue.capacity() && queue.empty());
+
+  // wrap around without growing.
+  for(int round = 0; round < 10; round++) {
+    queue.push_back(round);
+    queue.push_back(round + 1);
+    ASSERT(round == queue.front() && round + 1 == queue.back());
+    queue.pop_front();
+    queue.pop_front();
+  }
+  ASSERT(4 == queue.capacity() && queue.empty());
+
+  // grow while head is in the middle keeps order.
+  queue.push_back(1);
+  queue.push_back(2);
+  queue.pop_front();
+  for(int i = 3; i <= 10; i++) {
+    queue.push_back(i);
+  }
+  queue.push_front(1);
+  ASSERT(10 == queue.size() && 16 == queue.capacity());
+  for(size_t i = 0; i < queue.size(); i++) {
+    ASSERT((int)i + 1 == queue[i]);
+  }
+
+  // popped slot is reset, referenced resource released at once.
+  RingQueue<SpVecBuffer> buffers;
+  SpVecBuffer buffer(new VecBuffer(8));
+  buffers.push_back(buffer);
+  buffers.pop_front();
+  ASSERT(buffer.unique());
+
+  queue.clear();
+  ASSERT(queue.empty());
+  printf("ring queue ok\n");
+}
+
+void bench_ringQueue() {
+  const int count = 4000000;
+  const int depth = 64;
+  SpVecBuffer buffer(new VecBuffer(8));
+
+  for(int round = 0; round < 2; round++) {
+    RingQueue<SpVecBuffer> ring;
+    deque<SpVecBuffer> queue;
+    uint64_t start = TimeUtil::monotonicUs();
+    // keep about depth items queued like a send queue under pressure.
+    for(int i = 0; i < count; i++) {
+      if(0 == round) {
+        ring.push_back(buffer);
+        if(ring.size() > depth) {
+          ring.pop_front();
+        }
+      } else {
+        queue.push_back(buffer);
+        if(queue.size() > depth) {
+          queue.pop_front();
+        }
+      }
+    }
+    uint64_t cost = TimeUtil::monotonicUs() - start;
+    printf("bench %-24s %d ops, %.1f ns/op\n", (0 == round) ? "RingQueue" : "deque", count, cost * 1000.0 / count);
+  }
+}
+
+void bench_zeroCopySend() {
+  const int count = 1024;
+  const size_t size = 256 * 1024;
+  SpVecBuffer payload(new VecBuffer(size));
+  ::memset(payload->writtablePtr(), 'z', size);
+  payload->markWrite(size);
+
+  // loopback copies zero copy buffers anyway and connection falls back to copy once it's reported,
+  // run it on a real nic to see the gain.
+  for(int round = 0; round < 2; round++) {
+    shared_ptr<LooperPool<MultiplexLooper> > pool(new LooperPool<MultiplexLooper>(1));
+    TcpServer server(3101 + round, pool);
+    server.setConnectionHandler([&, round] (SpTcpConnection& conn) {
+        conn->setZeroCopyThreshold((0 == round) ? 0 : 64 * 1024);
+        conn->attach();
+        for(int i = 0; i < count; i++) {
+          conn->send(payload);
+        }
+      });
+    server.startWork();
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(3101 + round);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int ret = ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    ASSERT(0 == ret);
+
+    uint64_t start = TimeUtil::monotonicUs();
+    size_t total = 0;
+    char buffer[64 * 1024];
+    while(total < count * size) {
+      ssize_t readed = ::read(fd, buffer, sizeof(buffer));
+      if(readed <= 0) {
+        break;
+      }
+      total += readed;
+    }
+    uint64_t cost = TimeUtil::monotonicUs() - start;
+    ::close(fd);
+    server.stopWork();
+    printf("bench %-24s %zu bytes, %.1f MB/s\n", (0 == round) ? "send copy" : "send zero copy", total,
+           total / static_cast<double>(cost));
+  }
+}
+
+void bench_bufferPool() {
+  const int count = 2000000;
+  const int batch = 256;
+  void* ptrs[batch];
+
+  // same thread, blocks are freed in batches like buffers held by a send queue.
+  for(int round = 0; round < 2; round++) {
+    uint64_t start = TimeUtil::monotonicUs();
+    for(int i = 0; i < count; i += batch) {
+      for(int j = 0; j < batch; j++) {
+        size_t size = static_cast<size_t>(64) << ((i + j) % 7);
+        ptrs[j] = (0 == round) ? BufferPool::allocate(size) : ::malloc(size);
+      }
+      for(int j = 0; j < batch; j++) {
+        (0 == round) ? BufferPool::deallocate(ptrs[j]) : ::free(ptrs[j]);
+      }
+    }
+    uint64_t cost = TimeUtil::monotonicUs() - start;
+    printf("bench %-24s %d blocks, %.1f ns/op\n", (0 == round) ? "BufferPool local" : "malloc local", count,
+           cost * 1000.0 / count);
+  }
+
+  // allocated by one thread and freed by another, like buffers received by looper and consumed by workers.
+  for(int round = 0; round < 2; round++) {
+    mutex lock;
+    deque<vector<void*> > batches;
+    uint64_t start = TimeUtil::monotonicUs();
+    thread consumer([&] () {
+        int freed = 0;
+        while(freed < count) {
+          vector<void*> ptrs;
+          {
+            lock_guard<mutex> guard(lock);
+            if(!batches.empty()) {
+              ptrs.swap(batches.front());
+              batches.pop_front();
+            }
+          }
+          for(size_t j = 0; j < ptrs.size(); j++) {
+            (0 == round) ? BufferPool::deallocate(ptrs[j]) : ::free(ptrs[j]);
+          }
+          freed += static_cast<int>(ptrs.size());
+        }
+      });
+
+    for(int i = 0; i < count; i += batch) {
+      vector<void*> ptrs(batch);
+      for(int j = 0; j < batch; j++) {
+        size_t size = static_cast<size_t>(64) << ((i + j) % 7);
+        ptrs[j] = (0 == round) ? BufferPool::allocate(size) : ::malloc(size);
+      }
+      lock_guard<mutex> guard(lock);
+      batches.push_back(std::move(ptrs));
+    }
+    consumer.join();
+    uint64_t cost = TimeUtil::monotonicUs() - start;
+    printf("bench %-24s %d blocks, %.1f ns/op\n", (0 == round) ? "BufferPool cross thread" : "malloc cross thread",
+           count, cost * 1000.0 / count);
+  }
+}
+
+void test_endianVarint() {
+  // odd counts and unaligned start cover both shuffled blocks and the tail.
+  char raw[8 * 19 + 1];
+  for(size_t i = 0; i < sizeof(raw); i++) {
+    raw[i] = static_cast<char>(i * 13 + 1);
+  }
+  for(size_t elem = 2; elem <= 8; elem <<= 1) {
+    char data[sizeof(raw)];
+    ::memcpy(data, raw, sizeof(raw));
+    Endian::swapArray(data + 1, elem, 19);
+    for(size_t i = 0; i < 19; i++) {
+      for(size_t j = 0; j < elem; j++) {
+        ASSERT(data[1 + i * elem + j] == raw[1 + i * elem + elem - 1 - j]);
+      }
+    }
+  }
+
+  const uint64_t values[] = {0, 1, 127, 128, 300, 16383, 16384, 0xFFFFFFFFULL, 1ULL << 63, ~0ULL};
+  VecBuffer buffer(128);
+  for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    buffer.writeVarint(values[i]);
+  }
+  for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    uint64_t x = 0;
+    ASSERT(VARINT_OK == buffer.readVarint(x) && values[i] == x);
+  }
+
+  // truncated varint is not consumed until completed.
+  uint64_t x = 0;
+  const char truncated[] = {'\xAC', '\x02'};
+  buffer.writeBytes(truncated, 1);
+  ASSERT(VARINT_NEED_MORE == buffer.readVarint(x) && 1 == buffer.readableSize());
+  buffer.writeBytes(truncated + 1, 1);
+  ASSERT(VARINT_OK == buffer.readVarint(x) && 300 == x);
+
+  // 10th byte can only carry the highest bit, and no varint is longer than 10 bytes.
+  const char overflow[] = {'\xFF', '\xFF', '\xFF', '\xFF', '\xFF', '\xFF', '\xFF', '\xFF', '\xFF', '\x02'};
+  VecBuffer overflowed(16);
+  overflowed.writeBytes(overflow, sizeof(overflow));
+  ASSERT(VARINT_MALFORMED == overflowed.readVarint(x) && sizeof(overflow) == overflowed.readableSize());
+  const char tooLong[] = {'\x80', '\x80', '\x80', '\x80', '\x80', '\x80', '\x80', '\x80', '\x80', '\x80', '\x00'};
+  VecBuffer longer(16);
+  longer.writeBytes(tooLong, sizeof(tooLong));
+  ASSERT(VARINT_MALFORMED == longer.readVarint(x));
+  std::cout << "endian swap and varint ok" << std::endl;
+}
+
+void bench_endianVarint() {
+  const int rounds = 20000;
+  vector<uint32_t> data(4096);
+  for(size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<uint32_t>(i);
+  }
+
+  for(int round = 0; round < 2; round++) {
+    uint64_t start = TimeUtil::monotonicUs();
+    for(int r = 0; r < rounds; r++) {
+      if(0 == round) {
+        Endian::swapArray(&data[0], sizeof(uint32_t), data.size());
+      } else {
+        for(size_t i = 0; i < data.size(); i++) {
+          data[i] = ByteSwap<sizeof(uint32_t)>::swap(data[i]);
+        }
+      }
+    }
+    uint64_t cost = TimeUtil::monotonicUs() - start;
+    ASSERT(1 == data[1]);
+    printf("bench %-24s %zu uint32, %.2f ns/elem\n", (0 == round) ? "Endian::swapArray" : "scalar swap", data.size(),
+           cost * 1000.0 / rounds / data.size());
+  }
+
+  // values of 1~5 bytes varint.
+  const int count = 1000000;
+  VecBuffer buffer(count * 10);
+  uint64_t start = TimeUtil::monotonicUs();
+  for(int i = 0; i < count; i++) {
+    buffer.writeVarint(static_cast<uint64_t>(i) << ((i % 5) * 7));
+  }
+  uint64_t encoded = TimeUtil::monotonicUs();
+  uint64_t sum = 0;
+  uint64_t x = 0;
+  while(VARINT_OK == buffer.readVarint(x)) {
+    sum += x;
+  }
+  uint64_t decoded = TimeUtil::monotonicUs();
+  ASSERT(0 == buffer.readableSize() && sum > 0);
+  printf("bench %-24s %d values, encode %.1f ns, decode %.1f ns\n", "varint", count,
+         (encoded - start) * 1000.0 / count, (decoded - encoded) * 1000.0 / count);
+}
+
+void test_atomicBitmapTree() {
+  AtomicBitmapTree empty(0);
+  ASSERT(-1 == empty.bitRequire());
+
+  AtomicBitmapTree single(1);
+  ASSERT(0 == single.bitRequire() && -1 == single.bitRequire());
+  single.bitTurnback(0);
+  ASSERT(0 == single.bitRequire());
+
+  // no bit is held by two threads at once, trees used by the same threads don't disturb each other.
+  const size_t size = 5000;
+  const int threadCount = 4;
+  AtomicBitmapTree first(size);
+  AtomicBitmapTree second(size);
+  vector<atomic<bool> > held(size * 2);
+  vector<thread> threads;
+  for(int t = 0; t < threadCount; t++) {
+    threads.push_back(thread([&] () {
+          vector<size_t> mine;
+          for(int i = 0; i < 200000; i++) {
+            AtomicBitmapTree& tree = (0 == i % 3) ? second : first;
+            size_t base = (&tree == &second) ? size : 0;
+            off64_t idx = tree.bitRequire();
+            if(idx >= 0) {
+              ASSERT(static_cast<size_t>(idx) < size && !held[base + idx].exchange(true));
+              mine.push_back(base + idx);
+            }
+            if(mine.size() > size / threadCount || (idx < 0 && !mine.empty())) {
+              size_t off = mine[i % mine.size()];
+              mine[i % mine.size()] = mine.back();
+              mine.pop_back();
+              held[off].store(false);
+              (off >= size ? second : first).bitTurnback(off % size);
+            }
+          }
+          for(size_t i = 0; i < mine.size(); i++) {
+            held[mine[i]].store(false);
+            (mine[i] >= size ? second : first).bitTurnback(mine[i] % size);
+          }
+        }));
+  }
+  for(size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+
+  // every bit is back.
+  vector<bool> seen(size);
+  for(size_t i = 0; i < size; i++) {
+    off64_t idx = first.bitRequire();
+    ASSERT(idx >= 0 && static_cast<size_t>(idx) < size && !seen[idx]);
+    seen[idx] = true;
+  }
+  ASSERT(-1 == first.bitRequire());
+  std::cout << "atomic bitmap tree ok" << std::endl;
+}
+
+void bench_atomicBitmapTree() {
+  const size_t size = 64 * 64 * 16;
+  const int threadCount = 4;
+  const int count = 1000000;
+
+  for(int round = 0; round < 2; round++) {
+    AtomicBitmapTree atomicTree(size);
+    BitmapTree lockedTree(size);
+    uint64_t start = TimeUtil::monotonicUs();
+    vector<thread> threads;
+    for(int t = 0; t < threadCount; t++) {
+      threads.push_back(thread([&] () {
+            off64_t idxes[16];
+            for(int i = 0; i < count; i += 16) {
+              for(int j = 0; j < 16; j++) {
+                idxes[j] = (0 == round) ? atomicTree.bitRequire() : lockedTree.bitRequire();
+              }
+              for(int j = 0; j < 16; j++) {
+                (0 == round) ? atomicTree.bitTurnback(idxes[j]) : lockedTree.bitTurnback(idxes[j]);
+              }
+            }
+          }));
+    }
+    for(size_t i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+    uint64_t cost = TimeUtil::monotonicUs() - start;
+    printf("bench %-24s %d threads, %.1f ns per require+turnback\n",
+           (0 == round) ? "AtomicBitmapTree" : "BitmapTree", threadCount, cost * 1000.0 / count);
+  }
+}
+
+void bench_fixedBufferPool() {
+  typedef FixedBufferPool<1024, 2048> Pool;
+  const int count = 2000000;
+  const int batch = 64;
+
+  for(int threadCount = 1; threadCount <= 4; threadCount <<= 2) {
+    for(int round = 0; round < 2; round++) {
+      uint64_t start = TimeUtil::monotonicUs();
+      vector<thread> threads;
+      for(int t = 0; t < threadCount; t++) {
+        threads.push_back(thread([round] () {
+              void* ptrs[batch];
+              for(int i = 0; i < count; i += batch) {
+                for(int j = 0; j < batch; j++) {
+                  ptrs[j] = (0 == round) ? Pool::alloc() : ::malloc(2048);
+                  ASSERT(nullptr != ptrs[j]);
+                  // touch slot like a receiving buffer.
+                  *static_cast<char*>(ptrs[j]) = static_cast<char>(j);
+                }
+                for(int j = 0; j < batch; j++) {
+                  (0 == round) ? Pool::release(ptrs[j]) : ::free(ptrs[j]);
+                }
+              }
+            }));
+      }
+      for(size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+      }
+      uint64_t cost = TimeUtil::monotonicUs() - start;
+      printf("bench %-24s %d threads, %.1f ns/op\n", (0 == round) ? "FixedBufferPool 2K" : "malloc 2K", threadCount,
+             cost * 1000.0 / count);
+    }
+  }
+}
+
 int main(int argc, char *argv[])
 {
   /*
@@ -206,9 +899,31 @@ int main(int argc, char *argv[])
 
   //  test_looperPool();
   //  test_messageLooper();
+
+  if(argc > 1 && 0 == strcmp(argv[1], "bench")) {
+    bench_mpscQueue();
+    bench_flnpackRead();
+    bench_ringQueue();
+    bench_zeroCopySend();
+    bench_bufferPool();
+    bench_endianVarint();
+    bench_atomicBitmapTree();
+    bench_fixedBufferPool();
+    return 0;
+  }
+
+  test_looperPoolSelect();
+  test_connectionTable();
+  test_flnpackMalformed();
+  test_mpscQueue();
+  test_vecBufferShared();
+  test_ringQueue();
+  test_bufferChainCow();
+  test_endianVarint();
+  test_atomicBitmapTree();
   
   //test_tcpserver();
-  test_tcpclient();
+  //test_tcpclient();
   
   /*
   MultiplexLooper looper;